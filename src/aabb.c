@@ -0,0 +1,166 @@
+// ----------------------------------- aabb.c -------------------------------------
+#include "aabb.h"
+
+#include "heap.h"
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+/**
+ * Give a batch room for capacity boxes (rounded up to whole groups of
+ * AABB_LANES), from the heap for good
+ * Returns 0 if the memory is not there
+ */
+int aabb_init(AabbBatch *batch, unsigned int capacity) {
+  unsigned long bytes;
+
+  capacity = (capacity + AABB_LANES - 1) & ~(AABB_LANES - 1);
+  bytes = (unsigned long)capacity * sizeof(int);
+
+  batch->x1 = heap_alloc(bytes);
+  batch->y1 = heap_alloc(bytes);
+  batch->x2 = heap_alloc(bytes);
+  batch->y2 = heap_alloc(bytes);
+  batch->count = 0;
+  batch->capacity = (batch->x1 && batch->y1 && batch->x2 && batch->y2) ? capacity : 0;
+  return batch->capacity != 0;
+}
+
+/**
+ * Empty a batch
+ */
+void aabb_clear(AabbBatch *batch) {
+  batch->count = 0;
+}
+
+/**
+ * Add the box of width x height pixels at x, y (its far edges are
+ * x + width and y + height, like the entities' own tests)
+ * Returns its index in the batch, -1 if the batch is full
+ */
+int aabb_add(AabbBatch *batch, int x, int y, int width, int height) {
+  unsigned int i = batch->count;
+
+  if (i == batch->capacity)
+    return -1;
+
+  batch->x1[i] = x;
+  batch->y1[i] = y;
+  batch->x2[i] = x + width;
+  batch->y2[i] = y + height;
+  batch->count++;
+  return i;
+}
+
+/**
+ * Test the box x1, y1 - x2, y2 against every box of a batch
+ * Sets bit i of mask (AABB_MASK_WORDS(batch->count) words) if it overlaps
+ * box i, and clears the others. Returns how many it overlaps
+ */
+unsigned int aabb_test(const AabbBatch *batch, int x1, int y1, int x2, int y2, unsigned long *mask) {
+  unsigned int n = batch->count;
+  unsigned int hits = 0;
+
+  for (unsigned int w = 0; w < AABB_MASK_WORDS(n); w++)
+    mask[w] = 0;
+
+#ifdef __ARM_NEON
+  // Four boxes per loop, the lanes past the last box (the batch has room
+  // for them) are cut off the mask below
+  static const unsigned int laneBit[AABB_LANES] = {1, 2, 4, 8};
+  const uint32x4_t bit = vld1q_u32(laneBit);
+  const int32x4_t qx1 = vdupq_n_s32(x1), qy1 = vdupq_n_s32(y1);
+  const int32x4_t qx2 = vdupq_n_s32(x2), qy2 = vdupq_n_s32(y2);
+
+  for (unsigned int i = 0; i < n; i += AABB_LANES) {
+    uint32x4_t hit = vandq_u32(vcleq_s32(vld1q_s32(batch->x1 + i), qx2),
+                               vcgeq_s32(vld1q_s32(batch->x2 + i), qx1));
+    hit = vandq_u32(hit, vcleq_s32(vld1q_s32(batch->y1 + i), qy2));
+    hit = vandq_u32(hit, vcgeq_s32(vld1q_s32(batch->y2 + i), qy1));
+
+    unsigned long bits = vaddvq_u32(vandq_u32(hit, bit));
+    if (n - i < AABB_LANES)
+      bits &= (1UL << (n - i)) - 1;
+    if (bits) {
+      mask[i / AABB_MASK_BITS] |= bits << (i % AABB_MASK_BITS);
+      hits += (bits & 1) + ((bits >> 1) & 1) + ((bits >> 2) & 1) + (bits >> 3);
+    }
+  }
+#else
+  for (unsigned int i = 0; i < n; i++) {
+    if (batch->x1[i] <= x2 && batch->x2[i] >= x1 && batch->y1[i] <= y2 && batch->y2[i] >= y1) {
+      mask[i / AABB_MASK_BITS] |= 1UL << (i % AABB_MASK_BITS);
+      hits++;
+    }
+  }
+#endif
+
+  return hits;
+}
+
+/**
+ * Test every box of queries against a batch: masks holds one mask of
+ * AABB_MASK_WORDS(batch->count) words per query, in order
+ * Returns how many overlapping pairs there are
+ */
+unsigned int aabb_testBatch(const AabbBatch *batch, const AabbBatch *queries, unsigned long *masks) {
+  unsigned int words = AABB_MASK_WORDS(batch->count);
+  unsigned int hits = 0;
+
+  for (unsigned int q = 0; q < queries->count; q++) {
+    hits += aabb_test(batch, queries->x1[q], queries->y1[q], queries->x2[q], queries->y2[q], masks);
+    masks += words;
+  }
+  return hits;
+}
+
+// When [a1, a2] moving by d starts and stops overlapping [b1, b2], in
+// AABB_TOI_ONE per move: entering is rounded down and leaving up, so a
+// touch is never missed. Returns 0 if they never overlap
+static int axisTimes(int a1, int a2, int d, int b1, int b2, int *enter, int *leave) {
+  long in, out;
+
+  if (d == 0) {
+    *enter = 0;
+    *leave = AABB_TOI_ONE;
+    return a1 <= b2 && a2 >= b1;
+  }
+
+  // Distances to travel until the near edges meet and the far ones part
+  if (d > 0) {
+    in = (long)b1 - a2;
+    out = (long)b2 - a1;
+  } else {
+    in = (long)a1 - b2;
+    out = (long)a2 - b1;
+    d = -d;
+  }
+  if (out < 0)
+    return 0;  // moving away
+
+  *enter = (in < 0) ? 0 : (in * AABB_TOI_ONE) / d;
+  *leave = (out * AABB_TOI_ONE + d - 1) / d;
+  return 1;
+}
+
+/**
+ * Swept test: box a moves by dx, dy (relative to b, when both move) over
+ * one step. Returns when it first touches b, 0 to AABB_TOI_ONE, or -1 if
+ * it does not during the move. Fast boxes cannot pass through thin ones
+ */
+int aabb_sweep(const AabbBox *a, int dx, int dy, const AabbBox *b) {
+  int enterX, leaveX, enterY, leaveY;
+
+  if (!axisTimes(a->x1, a->x2, dx, b->x1, b->x2, &enterX, &leaveX) ||
+      !axisTimes(a->y1, a->y2, dy, b->y1, b->y2, &enterY, &leaveY))
+    return -1;
+
+  // Overlapping on both axes at once, during the move
+  int enter = (enterX > enterY) ? enterX : enterY;
+  int leave = (leaveX < leaveY) ? leaveX : leaveY;
+  if (leave > AABB_TOI_ONE)
+    leave = AABB_TOI_ONE;
+
+  return (enter <= leave) ? enter : -1;
+}
@@ -0,0 +1,40 @@
+// ----------------------------------- aabb.h -------------------------------------
+// Boxes tested at once by the NEON kernel, batches have room for whole groups
+#define AABB_LANES 4
+
+// Bits per hit mask word
+#define AABB_MASK_BITS 64
+
+// Words of hit mask needed for n boxes
+#define AABB_MASK_WORDS(n) (((n) + AABB_MASK_BITS - 1) / AABB_MASK_BITS)
+
+// Times of impact from aabb_sweep() run from 0 (start of the move) to this
+// (end of it)
+#define AABB_TOI_ONE 256
+
+/* One box, same rules as the batches */
+typedef struct {
+  int x1;
+  int y1;
+  int x2;
+  int y2;
+} AabbBox;
+
+/* Axis-aligned boxes packed as columns of corners, x1 <= x2 and y1 <= y2,
+ * both corners inside the box (touching boxes overlap) */
+typedef struct {
+  int *x1;
+  int *y1;
+  int *x2;
+  int *y2;
+  unsigned int count;
+  unsigned int capacity;  // a multiple of AABB_LANES
+} AabbBatch;
+
+/* Function Prototypes */
+int aabb_init(AabbBatch *batch, unsigned int capacity);
+void aabb_clear(AabbBatch *batch);
+int aabb_add(AabbBatch *batch, int x, int y, int width, int height);
+unsigned int aabb_test(const AabbBatch *batch, int x1, int y1, int x2, int y2, unsigned long *mask);
+unsigned int aabb_testBatch(const AabbBatch *batch, const AabbBatch *queries, unsigned long *masks);
+int aabb_sweep(const AabbBox *a, int dx, int dy, const AabbBox *b);
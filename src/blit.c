@@ -0,0 +1,121 @@
+// ----------------------------------- blit.c -------------------------------------
+#include "blit.h"
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+/* All vector loads and stores use byte elements: they never raise an
+ * alignment fault, even while the frame buffer is mapped as Device memory
+ * (MMU off). Stores are still kept 16-byte aligned for speed. */
+
+// Copy from the lowest address up (dst is below src or does not overlap)
+static void copyForward(unsigned char *dst, const unsigned char *src, unsigned long n) {
+  // Head: single bytes until dst is 16-byte aligned
+  while (n && ((unsigned long)dst & 15)) {
+    *dst++ = *src++;
+    n--;
+  }
+
+#ifdef __ARM_NEON
+  // Body: 64 bytes per loop, every load done before the first store
+  while (n >= 64) {
+    uint8x16_t a = vld1q_u8(src);
+    uint8x16_t b = vld1q_u8(src + 16);
+    uint8x16_t c = vld1q_u8(src + 32);
+    uint8x16_t d = vld1q_u8(src + 48);
+    vst1q_u8(dst, a);
+    vst1q_u8(dst + 16, b);
+    vst1q_u8(dst + 32, c);
+    vst1q_u8(dst + 48, d);
+    src += 64;
+    dst += 64;
+    n -= 64;
+  }
+
+  while (n >= 16) {
+    vst1q_u8(dst, vld1q_u8(src));
+    src += 16;
+    dst += 16;
+    n -= 16;
+  }
+#endif
+
+  // Tail
+  while (n--)
+    *dst++ = *src++;
+}
+
+// Copy from the highest address down (dst is above src and overlaps it)
+static void copyBackward(unsigned char *dst, const unsigned char *src, unsigned long n) {
+  dst += n;
+  src += n;
+
+  // Head: single bytes until the end of dst is 16-byte aligned
+  while (n && ((unsigned long)dst & 15)) {
+    *--dst = *--src;
+    n--;
+  }
+
+#ifdef __ARM_NEON
+  while (n >= 64) {
+    src -= 64;
+    dst -= 64;
+    uint8x16_t a = vld1q_u8(src);
+    uint8x16_t b = vld1q_u8(src + 16);
+    uint8x16_t c = vld1q_u8(src + 32);
+    uint8x16_t d = vld1q_u8(src + 48);
+    vst1q_u8(dst + 48, d);
+    vst1q_u8(dst + 32, c);
+    vst1q_u8(dst + 16, b);
+    vst1q_u8(dst, a);
+    n -= 64;
+  }
+
+  while (n >= 16) {
+    src -= 16;
+    dst -= 16;
+    vst1q_u8(dst, vld1q_u8(src));
+    n -= 16;
+  }
+#endif
+
+  // Tail
+  while (n--)
+    *--dst = *--src;
+}
+
+void blitCopy(unsigned char *dst, const unsigned char *src, unsigned long n) {
+  if (dst == src || n == 0)
+    return;
+
+  if (dst < src || dst >= src + n)
+    copyForward(dst, src, n);
+  else
+    copyBackward(dst, src, n);
+}
+
+void blitRect(unsigned char *dst, unsigned int dstPitch,
+              const unsigned char *src, unsigned int srcPitch,
+              unsigned int rowBytes, unsigned int rows) {
+  if (rows == 0)
+    return;
+
+  if (dst <= src) {
+    // Top row first, rows below in src are only overwritten after being read
+    while (rows--) {
+      blitCopy(dst, src, rowBytes);
+      dst += dstPitch;
+      src += srcPitch;
+    }
+  } else {
+    // Bottom row first, for rectangles moving down in memory
+    dst += (rows - 1) * (unsigned long)dstPitch;
+    src += (rows - 1) * (unsigned long)srcPitch;
+    while (rows--) {
+      blitCopy(dst, src, rowBytes);
+      dst -= dstPitch;
+      src -= srcPitch;
+    }
+  }
+}
@@ -0,0 +1,9 @@
+// ----------------------------------- blit.h -------------------------------------
+// Copy n bytes from src to dst, the two regions may overlap (memmove semantics)
+void blitCopy(unsigned char *dst, const unsigned char *src, unsigned long n);
+
+// Copy rows of rowBytes bytes between two surfaces with their own pitch
+// Overlapping rectangles on the same surface are handled like memmove
+void blitRect(unsigned char *dst, unsigned int dstPitch,
+              const unsigned char *src, unsigned int srcPitch,
+              unsigned int rowBytes, unsigned int rows);
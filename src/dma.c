@@ -0,0 +1,258 @@
+// ----------------------------------- dma.c -------------------------------------
+#include "dma.h"
+
+#include "frame.h"
+#include "irq.h"
+#include "mbox.h"
+#include "mmu.h"
+#include "uart.h"
+
+// Channels the ARM may use when the firmware does not tell (QEMU's answer)
+#define DMA_DEFAULT_CHANNELS 0x003C
+
+// A chain still running after this many milliseconds is given up on
+#define DMA_TIMEOUT_MS 100
+
+// The engine sees RAM at bus addresses, through the alias that skips the
+// GPU's L2 cache (our own data cache is cleaned separately)
+#define BUS_ADDR(p) ((unsigned int)(unsigned long)(p) | 0xC0000000)
+
+/* Control block, read by the engine from RAM (32-byte aligned). A fill has
+ * its value in the block itself and reads it again for every word */
+typedef struct {
+  unsigned int ti;      // transfer information
+  unsigned int source;  // bus addresses
+  unsigned int dest;
+  unsigned int length;  // 2D: rows << 16 | bytes per row
+  unsigned int stride;  // 2D: signed bytes skipped after each row, dest << 16 | source
+  unsigned int next;    // next block, 0 ends the chain
+  unsigned int value;   // fill value
+  unsigned int reserved;
+} __attribute__((aligned(32))) DmaBlock;
+
+// Chain of blocks per channel, filled by dma_fill()/dma_blit2d() and run
+// by dma_start()
+static DmaBlock dmaBlocks[DMA_FULL_CHANNELS][DMA_MAX_BLOCKS];
+static unsigned int dmaQueued[DMA_FULL_CHANNELS];
+static unsigned int dmaTaken = 0;  // one bit per allocated channel
+
+/**
+ * Take a full (2D capable) channel the firmware leaves to the ARM
+ * Returns the channel number, or -1 if none is left
+ */
+int dma_alloc() {
+  unsigned int usable = sysInfo.dmaChannels ? sysInfo.dmaChannels : DMA_DEFAULT_CHANNELS;
+
+  for (int ch = 0; ch < DMA_FULL_CHANNELS; ch++) {
+    if ((usable & (1 << ch)) && !(dmaTaken & (1 << ch))) {
+      dmaTaken |= 1 << ch;
+      dmaQueued[ch] = 0;
+
+      *DMA_ENABLE |= 1 << ch;
+      *DMA_CS(ch) = DMA_CS_RESET;
+      *ENABLE_IRQS_1 = IRQ_DMA(ch);  // completion wakes dma_wait()
+      return ch;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Give a channel back, once its transfers are done
+ */
+void dma_free(int ch) {
+  dma_wait(ch);
+  *DISABLE_IRQS_1 = IRQ_DMA(ch);
+  dmaTaken &= ~(1 << ch);
+}
+
+// Next free block of a channel's chain for a 2D transfer, 0 if the
+// channel is running, its chain is full or the size is out of range
+static DmaBlock *queue(int ch, unsigned int rowBytes, unsigned int rows) {
+  if (ch < 0 || dma_busy(ch) || dmaQueued[ch] == DMA_MAX_BLOCKS)
+    return 0;
+  if (rowBytes == 0 || rows == 0 || rowBytes > DMA_MAX_ROW_BYTES || rows > DMA_MAX_ROWS)
+    return 0;
+
+  DmaBlock *b = &dmaBlocks[ch][dmaQueued[ch]++];
+  b->length = (rows << 16) | rowBytes;
+  b->next = 0;
+  return b;
+}
+
+// Does a row stride fit the 16-bit field (positive ones only)?
+static int strideFits(long stride) {
+  return stride >= 0 && stride <= 0x7FFF;
+}
+
+/**
+ * Queue a fill of rows x rowBytes at dst with a 32-bit value (the pixel
+ * repeated). dst, dstPitch and rowBytes must be whole words
+ * Returns 0 if it cannot be done by DMA
+ */
+int dma_fill(int ch, void *dst, unsigned int dstPitch, unsigned int rowBytes, unsigned int rows, unsigned int value) {
+  long step = (long)dstPitch - rowBytes;
+
+  if (((unsigned long)dst & 3) || (dstPitch & 3) || (rowBytes & 3) || !strideFits(step))
+    return 0;
+
+  DmaBlock *b = queue(ch, rowBytes, rows);
+  if (!b)
+    return 0;
+
+  b->ti = DMA_TI_TDMODE | DMA_TI_DEST_INC | DMA_TI_WAIT_RESP;
+  b->value = value;
+  b->source = BUS_ADDR(&b->value);
+  b->dest = BUS_ADDR(dst);
+  b->stride = (step & 0xFFFF) << 16;
+  return 1;
+}
+
+// Queue one 2D copy block (room and sizes checked by the caller)
+static void queueCopy(int ch, unsigned long d, unsigned int dstPitch, unsigned long s, unsigned int srcPitch, unsigned int rowBytes, unsigned int rows) {
+  DmaBlock *b = queue(ch, rowBytes, rows);
+
+  b->ti = DMA_TI_TDMODE | DMA_TI_DEST_INC | DMA_TI_SRC_INC | DMA_TI_WAIT_RESP;
+  b->source = BUS_ADDR(s);
+  b->dest = BUS_ADDR(d);
+  b->stride = ((dstPitch - rowBytes) << 16) | (srcPitch - rowBytes);
+}
+
+/**
+ * Queue a copy of rows x rowBytes from src to dst. Overlapping rectangles
+ * with the same pitch are fine (moveRect()), except moves right by less
+ * than a row: the engine copies each row front to back
+ * Returns 0 if it cannot be done by DMA (nothing is queued then)
+ */
+int dma_blit2d(int ch, void *dst, unsigned int dstPitch, const void *src, unsigned int srcPitch, unsigned int rowBytes, unsigned int rows) {
+  unsigned long d = (unsigned long)dst, s = (unsigned long)src;
+  unsigned long dEnd = d + (rows - 1) * (unsigned long)dstPitch + rowBytes;
+  unsigned long sEnd = s + (rows - 1) * (unsigned long)srcPitch + rowBytes;
+  unsigned int band = rows;
+
+  if (ch < 0 || dma_busy(ch) || rowBytes == 0 || rowBytes > DMA_MAX_ROW_BYTES || rows == 0 || rows > DMA_MAX_ROWS)
+    return 0;
+  if (!strideFits((long)dstPitch - rowBytes) || !strideFits((long)srcPitch - rowBytes))
+    return 0;
+
+  if (d > s && d < sEnd && s < dEnd) {
+    unsigned long shift = d - s;
+
+    // A row written over its own source or the next row's
+    if (dstPitch != srcPitch || shift < rowBytes || (shift < dstPitch && shift + rowBytes > dstPitch))
+      return 0;
+
+    // Moving down: rows go top to bottom inside a band, so bands are at
+    // most as tall as the move and are copied from the bottom one up,
+    // each is then read before a band below it is written over it
+    if (shift / dstPitch > 0 && shift / dstPitch < rows)
+      band = shift / dstPitch;
+  }
+
+  // All of it or nothing
+  if (dmaQueued[ch] + (rows + band - 1) / band > DMA_MAX_BLOCKS)
+    return 0;
+
+  for (unsigned int top = rows; top > 0;) {
+    unsigned int n = (top >= band) ? band : top;
+    top -= n;
+    queueCopy(ch, d + top * (unsigned long)dstPitch, dstPitch, s + top * (unsigned long)srcPitch, srcPitch, rowBytes, n);
+  }
+  return 1;
+}
+
+/**
+ * Run everything queued on a channel, in order, without waiting
+ * The memory it touches must not be cached (the frame buffer), or be
+ * cleaned/invalidated by the caller
+ */
+void dma_start(int ch) {
+  unsigned int n = dmaQueued[ch];
+  DmaBlock *blocks = dmaBlocks[ch];
+
+  if (n == 0)
+    return;
+
+  for (unsigned int i = 0; i + 1 < n; i++)
+    blocks[i].next = BUS_ADDR(&blocks[i + 1]);
+  blocks[n - 1].ti |= DMA_TI_INTEN;  // only the end of the chain interrupts
+  dmaQueued[ch] = 0;
+
+  // The engine reads the blocks from RAM, and the CPU's frame buffer
+  // writes must have landed before it overwrites or copies them
+  dcache_clean(blocks, n * sizeof(DmaBlock));
+
+  *DMA_CS(ch) = DMA_CS_END | DMA_CS_INT;  // flags of the previous run
+  *DMA_CONBLK_AD(ch) = BUS_ADDR(blocks);
+  *DMA_CS(ch) = DMA_CS_WAIT_WRITES | DMA_CS_PANIC_PRIORITY(15) | DMA_CS_PRIORITY(8) | DMA_CS_ACTIVE;
+}
+
+/**
+ * Is the channel still running its chain? Does not wait
+ */
+int dma_busy(int ch) {
+  unsigned int cs = *DMA_CS(ch);
+  return (cs & DMA_CS_ACTIVE) && !(cs & DMA_CS_ERROR);
+}
+
+static unsigned long counter() {
+  unsigned long t;
+  asm volatile("mrs %0, cntpct_el0"
+               : "=r"(t));
+  return t;
+}
+
+/**
+ * Wait for the channel's chain to finish, for DMA_TIMEOUT_MS at most
+ * A channel stopping on an error raises no interrupt, so the core only
+ * sleeps while the frame tick is there to wake it again, and spins on
+ * the status otherwise (menus)
+ * Returns 0 if the engine stopped on an error or timed out (the channel
+ * is then reset), non-zero on success
+ */
+int dma_wait(int ch) {
+  unsigned long freq;
+  asm volatile("mrs %0, cntfrq_el0"
+               : "=r"(freq));
+  unsigned long deadline = counter() + freq / 1000 * DMA_TIMEOUT_MS;
+  int sleep = frame_ticking();
+
+  while (1) {
+    unsigned long flags = irq_save();
+    if (!dma_busy(ch) || counter() > deadline) {
+      irq_restore(flags);
+      break;
+    }
+    if (sleep)
+      asm volatile("wfi");  // the last block's interrupt or a tick wakes us
+    irq_restore(flags);
+  }
+
+  if (*DMA_CS(ch) & DMA_CS_ERROR) {
+    uart_puts("DMA error on channel ");
+    uart_dec(ch);
+    uart_puts(", debug ");
+    uart_hex(*DMA_DEBUG(ch));
+    uart_puts("\n");
+    *DMA_CS(ch) = DMA_CS_RESET;
+    return 0;
+  }
+  if (dma_busy(ch)) {
+    uart_puts("DMA timeout on channel ");
+    uart_dec(ch);
+    uart_puts("\n");
+    *DMA_CS(ch) = DMA_CS_RESET;
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * DMA interrupt: acknowledge the channels that finished their chain
+ */
+IRQ_HANDLER void dma_irq() {
+  for (int ch = 0; ch < DMA_FULL_CHANNELS; ch++) {
+    if ((dmaTaken & (1 << ch)) && (*DMA_CS(ch) & DMA_CS_INT))
+      *DMA_CS(ch) = DMA_CS_INT;
+  }
+}
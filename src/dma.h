@@ -0,0 +1,50 @@
+// ----------------------------------- dma.h -------------------------------------
+#include "gpio.h"
+
+/* Registers: channels 0-14 are 0x100 apart, 0-6 are full channels (with 2D
+ * mode), 7-14 are lite ones. Channel 15 lives elsewhere and is not used */
+#define DMA_BASE (MMIO_BASE + 0x00007000)
+#define DMA_CS(ch) ((volatile unsigned int *)(DMA_BASE + 0x100UL * (ch) + 0x00))
+#define DMA_CONBLK_AD(ch) ((volatile unsigned int *)(DMA_BASE + 0x100UL * (ch) + 0x04))
+#define DMA_DEBUG(ch) ((volatile unsigned int *)(DMA_BASE + 0x100UL * (ch) + 0x20))
+#define DMA_INT_STATUS ((volatile unsigned int *)(DMA_BASE + 0xFE0))
+#define DMA_ENABLE ((volatile unsigned int *)(DMA_BASE + 0xFF0))
+
+#define DMA_FULL_CHANNELS 7
+
+// Control and status
+#define DMA_CS_ACTIVE (1 << 0)
+#define DMA_CS_END (1 << 1)  // write 1 to clear
+#define DMA_CS_INT (1 << 2)  // write 1 to clear
+#define DMA_CS_ERROR (1 << 8)
+#define DMA_CS_PRIORITY(p) ((p) << 16)
+#define DMA_CS_PANIC_PRIORITY(p) ((p) << 20)
+#define DMA_CS_WAIT_WRITES (1 << 28)  // END only once the writes landed
+#define DMA_CS_ABORT (1 << 30)
+#define DMA_CS_RESET (1U << 31)
+
+// Transfer information (control block word 0)
+#define DMA_TI_INTEN (1 << 0)
+#define DMA_TI_TDMODE (1 << 1)  // 2D: rows of XLENGTH bytes, strides between
+#define DMA_TI_WAIT_RESP (1 << 3)
+#define DMA_TI_DEST_INC (1 << 4)
+#define DMA_TI_SRC_INC (1 << 8)
+
+// 2D transfer limits: XLENGTH is 16 bits, YLENGTH (rows) 14 bits. The
+// strides are signed 16 bits, but QEMU does not extend the sign, so only
+// positive ones are used
+#define DMA_MAX_ROW_BYTES 0xFFFF
+#define DMA_MAX_ROWS 0x3FFF
+
+// Control blocks a channel can queue before dma_start()
+#define DMA_MAX_BLOCKS 256
+
+/* Function Prototypes */
+int dma_alloc();
+void dma_free(int ch);
+int dma_fill(int ch, void *dst, unsigned int dstPitch, unsigned int rowBytes, unsigned int rows, unsigned int value);
+int dma_blit2d(int ch, void *dst, unsigned int dstPitch, const void *src, unsigned int srcPitch, unsigned int rowBytes, unsigned int rows);
+void dma_start(int ch);
+int dma_busy(int ch);
+int dma_wait(int ch);
+void dma_irq();
@@ -0,0 +1,188 @@
+// ----------------------------------- entity.c -------------------------------------
+#include "entity.h"
+
+#include "heap.h"
+
+// Column of capacity elements from the heap, 0 (and *ok cleared) if the
+// heap is out of memory
+static void *column(unsigned int capacity, unsigned int size, int *ok) {
+  void *p = heap_alloc((unsigned long)capacity * size);
+  if (!p)
+    *ok = 0;
+  return p;
+}
+
+/**
+ * Give a store room for capacity entities, from the heap (for good)
+ * Returns 0 if the memory is not there
+ */
+int entity_init(EntityStore *store, unsigned int capacity) {
+  int ok = capacity > 0 && capacity <= ENTITY_MAX_CAPACITY;
+
+  if (ok) {
+    store->x = column(capacity, sizeof(int), &ok);
+    store->y = column(capacity, sizeof(int), &ok);
+    store->width = column(capacity, sizeof(unsigned short), &ok);
+    store->height = column(capacity, sizeof(unsigned short), &ok);
+    store->vx = column(capacity, sizeof(short), &ok);
+    store->vy = column(capacity, sizeof(short), &ok);
+    store->type = column(capacity, sizeof(unsigned char), &ok);
+    store->flags = column(capacity, sizeof(unsigned char), &ok);
+    store->sprite = column(capacity, sizeof(int), &ok);
+    store->owner = column(capacity, sizeof(Entity), &ok);
+    store->handle = column(capacity, sizeof(Entity), &ok);
+    store->slotIndex = column(capacity, sizeof(unsigned int), &ok);
+    store->slotGeneration = column(capacity, sizeof(unsigned short), &ok);
+  }
+
+  store->capacity = ok ? capacity : 0;
+  store->count = 0;
+  if (ok) {
+    for (unsigned int s = 0; s < capacity; s++)
+      store->slotGeneration[s] = 0;
+  }
+  entity_clear(store);
+  return ok;
+}
+
+/**
+ * Remove every entity. Their handles all go stale
+ */
+void entity_clear(EntityStore *store) {
+  for (unsigned int i = 0; i < store->count; i++)
+    store->slotGeneration[store->handle[i] & 0xFFFF]++;
+  store->count = 0;
+
+  // Chain the free slots in order, so the first entity gets slot 0
+  for (unsigned int s = 0; s < store->capacity; s++)
+    store->slotIndex[s] = s + 1;
+  store->freeSlot = 0;
+}
+
+/**
+ * Add an entity at the end of the store, standing still and with no
+ * flags, sprite or owner
+ * Returns its handle, or ENTITY_NONE if the store is full
+ */
+Entity entity_add(EntityStore *store, unsigned int type, int x, int y, unsigned int width, unsigned int height) {
+  unsigned int i = store->count;
+  unsigned int slot = store->freeSlot;
+
+  if (i == store->capacity)
+    return ENTITY_NONE;
+
+  // Generation 0 is never used, so no handle is ENTITY_NONE
+  if (store->slotGeneration[slot] == 0)
+    store->slotGeneration[slot] = 1;
+  store->freeSlot = store->slotIndex[slot];
+  store->slotIndex[slot] = i;
+
+  Entity e = ((Entity)store->slotGeneration[slot] << 16) | slot;
+  store->x[i] = x;
+  store->y[i] = y;
+  store->width[i] = width;
+  store->height[i] = height;
+  store->vx[i] = 0;
+  store->vy[i] = 0;
+  store->type[i] = type;
+  store->flags[i] = 0;
+  store->sprite[i] = -1;
+  store->owner[i] = ENTITY_NONE;
+  store->handle[i] = e;
+  store->count++;
+  return e;
+}
+
+/**
+ * Remove the entity at dense index i: the last one moves into its place
+ */
+void entity_remove(EntityStore *store, int i) {
+  unsigned int last = store->count - 1;
+
+  if (i < 0 || (unsigned int)i >= store->count)
+    return;
+
+  unsigned int slot = store->handle[i] & 0xFFFF;
+
+  if ((unsigned int)i != last) {
+    store->x[i] = store->x[last];
+    store->y[i] = store->y[last];
+    store->width[i] = store->width[last];
+    store->height[i] = store->height[last];
+    store->vx[i] = store->vx[last];
+    store->vy[i] = store->vy[last];
+    store->type[i] = store->type[last];
+    store->flags[i] = store->flags[last];
+    store->sprite[i] = store->sprite[last];
+    store->owner[i] = store->owner[last];
+    store->handle[i] = store->handle[last];
+    store->slotIndex[store->handle[i] & 0xFFFF] = i;
+  }
+  store->count--;
+
+  // The handle goes stale, the slot is free again
+  store->slotGeneration[slot]++;
+  store->slotIndex[slot] = store->freeSlot;
+  store->freeSlot = slot;
+}
+
+/**
+ * Remove every entity of a type
+ */
+void entity_removeType(EntityStore *store, unsigned int type) {
+  ENTITY_EACH(store, i, type) {
+    entity_remove(store, i);
+  }
+}
+
+/**
+ * Dense index of an entity, -1 if it has been removed
+ */
+int entity_index(EntityStore *store, Entity e) {
+  unsigned int slot = e & 0xFFFF;
+
+  if (e == ENTITY_NONE || slot >= store->capacity || store->slotGeneration[slot] != (e >> 16))
+    return -1;
+  return store->slotIndex[slot];
+}
+
+/**
+ * Dense index of the first entity of a type at or below from, -1 if none
+ */
+int entity_find(EntityStore *store, int from, unsigned int type) {
+  const unsigned char *types = store->type;
+
+  for (int i = from; i >= 0; i--) {
+    if (types[i] == type)
+      return i;
+  }
+  return -1;
+}
+
+/**
+ * Number of entities of a type
+ */
+int entity_count(EntityStore *store, unsigned int type) {
+  int n = 0;
+
+  for (unsigned int i = 0; i < store->count; i++)
+    n += store->type[i] == type;
+  return n;
+}
+
+/**
+ * Move every entity by its velocity, one step
+ * Returns non-zero if any of them moved
+ */
+int entity_move(EntityStore *store) {
+  int *x = store->x, *y = store->y;
+  const short *vx = store->vx, *vy = store->vy;
+  int moved = 0;
+
+  for (unsigned int i = 0; i < store->count; i++) {
+    x[i] += vx[i];
+    y[i] += vy[i];
+    moved |= vx[i] | vy[i];
+  }
+  return moved != 0;
+}
@@ -0,0 +1,51 @@
+// ----------------------------------- entity.h -------------------------------------
+// Most entities a store is ever created with (handles keep 16 bits of slot)
+#define ENTITY_MAX_CAPACITY 65536
+
+// Handle of no entity, never handed out
+#define ENTITY_NONE 0
+
+/* Stable name of an entity: generation << 16 | slot. It goes stale when
+ * the entity is removed, even if its slot is used again */
+typedef unsigned int Entity;
+
+/* Entities as columns (structure of arrays), packed densely: entity i of
+ * the store is x[i], y[i]... for i < count. Removing one moves the last
+ * into its place, so dense indices change and handles are what to keep */
+typedef struct {
+  int *x;
+  int *y;
+  unsigned short *width;
+  unsigned short *height;
+  short *vx;  // added to x/y by entity_move(), every step
+  short *vy;
+  unsigned char *type;
+  unsigned char *flags;
+  int *sprite;     // drawn with blitSprite()
+  Entity *owner;   // entity that made this one, or ENTITY_NONE
+  Entity *handle;  // handle of the entity at each dense index
+  unsigned int count;
+  unsigned int capacity;
+
+  // Per slot: dense index while in use, next free slot while not
+  unsigned int *slotIndex;
+  unsigned short *slotGeneration;
+  unsigned int freeSlot;
+} EntityStore;
+
+// Every entity of one type, from the last to the first: removing the
+// current one (the last takes its place, and was seen already) or adding
+// new ones (at the end) does not upset the loop
+#define ENTITY_EACH(store, i, t) \
+  for (int i = entity_find((store), (int)(store)->count - 1, (t)); i >= 0; i = entity_find((store), i - 1, (t)))
+
+/* Function Prototypes */
+int entity_init(EntityStore *store, unsigned int capacity);
+void entity_clear(EntityStore *store);
+Entity entity_add(EntityStore *store, unsigned int type, int x, int y, unsigned int width, unsigned int height);
+void entity_remove(EntityStore *store, int i);
+void entity_removeType(EntityStore *store, unsigned int type);
+int entity_index(EntityStore *store, Entity e);
+int entity_find(EntityStore *store, int from, unsigned int type);
+int entity_count(EntityStore *store, unsigned int type);
+int entity_move(EntityStore *store);
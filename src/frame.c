@@ -0,0 +1,156 @@
+// ----------------------------------- frame.c -------------------------------------
+#include "frame.h"
+
+#include "irq.h"
+
+/* ARM local timer interrupt routing of each core */
+#define CORE_TIMER_IRQCNTL(core) ((volatile unsigned int *)(0x40000040 + 4 * (core)))
+#define CNTP_IRQ (1 << 1)  // physical (non-secure) timer, CNTP
+
+#define CNTP_ENABLE 1
+
+// Timer counts per tick, ticks counted by the interrupt so far and
+// the tick the last frame_begin() caught up to
+static unsigned long period;
+static volatile unsigned int ticks;
+static unsigned int lastTick;
+
+// When the current frame started, frames that took longer than their
+// share of ticks and ticks dropped by FRAME_MAX_STEPS
+static unsigned long frameStart;
+static unsigned int overruns, skipped;
+
+// Frames are paced by an accumulator: every tick adds renderRate to the
+// credit, a frame costs tickRate of it. At 75 ticks and 60 frames per
+// second, four ticks in five are drawn. renderPeriod is a frame's share
+// of time in timer counts
+static unsigned int tickRate, renderRate, renderCredit;
+static unsigned long renderPeriod;
+
+static unsigned long counter() {
+  unsigned long t;
+  asm volatile("mrs %0, cntpct_el0"
+               : "=r"(t));
+  return t;
+}
+
+/**
+ * Start ticking the simulation hz times per second (CNTP interrupt),
+ * frames are drawn at most renderHz times per second
+ */
+void frame_start(unsigned int hz, unsigned int renderHz) {
+  unsigned long freq;
+  asm volatile("mrs %0, cntfrq_el0"
+               : "=r"(freq));
+
+  period = freq / hz;
+  ticks = 0;
+  lastTick = 0;
+
+  tickRate = hz;
+  renderRate = (renderHz && renderHz < hz) ? renderHz : hz;
+  renderCredit = tickRate;  // draw the first frame right away
+  renderPeriod = freq / renderRate;
+
+  asm volatile("msr cntp_cval_el0, %0" ::"r"(counter() + period));
+  asm volatile("msr cntp_ctl_el0, %0" ::"r"((unsigned long)CNTP_ENABLE));
+  *CORE_TIMER_IRQCNTL(0) = CNTP_IRQ;
+}
+
+/**
+ * Stop the tick (menus sleep on input alone)
+ */
+void frame_stop() {
+  asm volatile("msr cntp_ctl_el0, xzr");
+}
+
+/**
+ * Is the tick running on the calling core? Its interrupt then ends any
+ * wfi within a period
+ */
+int frame_ticking() {
+  unsigned long ctl;
+  asm volatile("mrs %0, cntp_ctl_el0"
+               : "=r"(ctl));
+  return ctl & CNTP_ENABLE;
+}
+
+/**
+ * Timer interrupt: count the tick and schedule the next one
+ * Compare values advance by whole periods so the rate does not drift,
+ * ticks missed while interrupts were off are counted all the same
+ */
+IRQ_HANDLER void frame_tick() {
+  unsigned long cval, now = counter();
+  asm volatile("mrs %0, cntp_cval_el0"
+               : "=r"(cval));
+
+  do {
+    ticks++;
+    cval += period;
+  } while (cval <= now);
+
+  asm volatile("msr cntp_cval_el0, %0" ::"r"(cval));
+}
+
+/**
+ * Sleep until the next tick, unless one already went by, and return
+ * how many simulation steps to run before rendering (1 - FRAME_MAX_STEPS)
+ */
+unsigned int frame_begin() {
+  unsigned int steps;
+
+  /* interrupts are masked around the check, so a tick coming just
+   * before wfi still wakes it up */
+  while (1) {
+    unsigned long flags = irq_save();
+    steps = ticks - lastTick;
+    if (steps) {
+      irq_restore(flags);
+      break;
+    }
+    asm volatile("wfi");
+    irq_restore(flags);
+  }
+
+  lastTick += steps;
+  if (steps > FRAME_MAX_STEPS) {
+    skipped += steps - FRAME_MAX_STEPS;
+    steps = FRAME_MAX_STEPS;
+  }
+  // Frames not drawn (nothing changed) are not made up for later
+  renderCredit += steps * renderRate;
+  if (renderCredit > 2 * tickRate)
+    renderCredit = 2 * tickRate;
+
+  frameStart = counter();
+  return steps;
+}
+
+/**
+ * Is it time to draw? True renderHz times per second on average, spread
+ * over the ticks. The ticks in between only run the simulation
+ */
+int frame_renderDue() {
+  if (renderCredit < tickRate)
+    return 0;
+
+  renderCredit -= tickRate;
+  return 1;
+}
+
+/**
+ * Mark the end of the frame's work (simulation, rendering, present)
+ */
+void frame_end() {
+  if (counter() - frameStart > renderPeriod)
+    overruns++;
+}
+
+// Get frame scheduler statistics (any pointer may be 0)
+void frame_stats(unsigned int *overrunFrames, unsigned int *skippedTicks) {
+  if (overrunFrames)
+    *overrunFrames = overruns;
+  if (skippedTicks)
+    *skippedTicks = skipped;
+}
@@ -0,0 +1,13 @@
+// ----------------------------------- frame.h -------------------------------------
+// Most simulation steps run for one frame, when rendering falls further
+// behind the extra ticks are skipped (the game slows down instead)
+#define FRAME_MAX_STEPS 8
+
+void frame_start(unsigned int hz, unsigned int renderHz);
+void frame_stop();
+int frame_ticking();
+unsigned int frame_begin();
+int frame_renderDue();
+void frame_end();
+void frame_stats(unsigned int *overruns, unsigned int *skipped);
+void frame_tick();
@@ -1,103 +1,409 @@
 // ----------------------------------- framebf.c -------------------------------------
 #include "framebf.h"
 
+#include "blit.h"
+#include "dma.h"
 #include "mbox.h"
 #include "terminal.h"
+#include "tile.h"
 #include "uart.h"
 
-// Use RGBA32 (32 bits for each pixel)
-#define COLOR_DEPTH 32
-
 // Pixel Order: BGR in memory order (little endian --> RGB in byte order)
+// RGB565 is packed the usual way (red in the top bits) with RGB order, and
+// 8-bit palette entries use the same layout as 32-bit pixels
+#if COLOR_DEPTH == 16
+#define PIXEL_ORDER 1
+#else
 #define PIXEL_ORDER 0  // Screen info
+#endif
+
+// A 64-bit word holding the same pixel in every slot is color * WIDE_REPEAT
+#if COLOR_DEPTH == 8
+#define WIDE_REPEAT 0x0101010101010101UL
+#elif COLOR_DEPTH == 16
+#define WIDE_REPEAT 0x0001000100010001UL
+#else
+#define WIDE_REPEAT 0x0000000100000001UL
+#endif
+#define PIXELS_PER_WORD (8 / BYTES_PER_PIXEL)
+
+// Most palette entries set in one mailbox call
+#define PALETTE_MAX_BATCH 28
+
+// Smaller fills and copies are done by the CPU, cheaper than setting up DMA
+#define DMA_MIN_BYTES 4096
+
+// Depth of the clip rectangle stack
+#define CLIP_STACK_DEPTH 8
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
-unsigned int width, height, pitch;
+unsigned int width, height, screenPitch;
 
-/* Frame buffer address
+/* Address and pitch of the surface being drawn, per core: the back buffer,
+ * an off-screen surface set by framebf_setTarget() or a tile buffer
  * (declare as pointer of unsigned char to access each byte) */
-unsigned char *fb;
+DrawTarget drawTargets[DRAW_CORES] = {[0].clipRect = {0, 0, -1, -1}};
+int offscreen = 0;
+
+// The 16 colors of vgapal in the frame buffer's pixel format
+pixel_t palette[16];
+
+// Clip rectangles: the bottom of the stack is the whole drawing surface and
+// each pushed region is intersected with the one below. Every primitive is
+// clipped against the top one, kept in the core's
+// DrawTarget (the stack belongs to core 0, the tile renderer sets the other
+// cores' clipRect directly)
+ClipRect clipStack[CLIP_STACK_DEPTH];
+int clipDepth = 0;
+
+// Start of the whole virtual frame buffer, number of pages it holds,
+// index and address of the current back page
+unsigned char *fbBase, *backBuffer;
+unsigned int numPages = 1, backPage = 0;
+
+// Page flip still in flight (mailbox handle), -1 if none
+int flipHandle = -1;
+
+// DMA channel for frame buffer fills and copies, -1 if none
+int fbDma = -1;
+
+// Convert the vgapal colors to the frame buffer's pixel format
+static void initPalette() {
+  for (int i = 0; i < 16; i++) {
+#if COLOR_DEPTH == 8
+    palette[i] = i;  // the GPU palette holds vgapal itself
+#elif COLOR_DEPTH == 16
+    unsigned int rgb = vgapal[i];
+    palette[i] = ((rgb >> 8) & 0xf800) | ((rgb >> 5) & 0x07e0) | ((rgb >> 3) & 0x001f);
+#else
+    palette[i] = vgapal[i];
+#endif
+  }
+}
 
+// Set up the frame buffer, in the one mailbox call made at boot: the
+// system queries (ARM memory for mmu_init(), clocks...) ride along, and
+// so does the palette in 8-bit mode
 void framebf_init() {
-  mBuf[0] = 35 * 4;  // Length of message in bytes
-  mBuf[1] = MBOX_REQUEST;
-
-  mBuf[2] = MBOX_TAG_SETPHYWH;  // Set physical width-height
-  mBuf[3] = 8;                  // Value size in bytes
-  mBuf[4] = 0;                  // REQUEST CODE = 0
-  mBuf[5] = WIDTH;              // Value(width)
-  mBuf[6] = HEIGHT;             // Value(height)
-
-  mBuf[7] = MBOX_TAG_SETVIRTWH;  // Set virtual width-height
-  mBuf[8] = 8;
-  mBuf[9] = 0;
-  mBuf[10] = WIDTH;
-  mBuf[11] = HEIGHT;
-
-  mBuf[12] = MBOX_TAG_SETVIRTOFF;  // Set virtual offset
-  mBuf[13] = 8;
-  mBuf[14] = 0;
-  mBuf[15] = 0;  // x offset
-  mBuf[16] = 0;  // y offset
-
-  mBuf[17] = MBOX_TAG_SETDEPTH;  // Set color depth
-  mBuf[18] = 4;
-  mBuf[19] = 0;
-  mBuf[20] = COLOR_DEPTH;  // Bits per pixel
-
-  mBuf[21] = MBOX_TAG_SETPXLORDR;  // Set pixel order
-  mBuf[22] = 4;
-  mBuf[23] = 0;
-  mBuf[24] = PIXEL_ORDER;
-
-  mBuf[25] = MBOX_TAG_GETFB;  // Get frame buffer
-  mBuf[26] = 8;
-  mBuf[27] = 0;
-  mBuf[28] = 16;  // alignment in 16 bytes
-  mBuf[29] = 0;   // will return Frame Buffer size in bytes
-
-  mBuf[30] = MBOX_TAG_GETPITCH;  // Get pitch
-  mBuf[31] = 4;
-  mBuf[32] = 0;
-  mBuf[33] = 0;  // Will get pitch value here
-  mBuf[34] = MBOX_TAG_LAST;
+  MboxMsg msg;
+
+  initPalette();
+
+  mbox_start(&msg, mBuf);
+
+  volatile MboxSize *phys = MBOX_ADD(&msg, SETPHYWH);  // Set physical width-height
+  phys->width = WIDTH;
+  phys->height = HEIGHT;
+
+  volatile MboxSize *virt = MBOX_ADD(&msg, SETVIRTWH);  // Set virtual width-height
+  virt->width = WIDTH;
+  virt->height = HEIGHT * FB_BUFFERS;  // One screen-sized page per buffer
+
+  MBOX_ADD(&msg, SETVIRTOFF);  // Set virtual offset, 0, 0
+
+  volatile MboxWord *depth = MBOX_ADD(&msg, SETDEPTH);  // Set color depth
+  depth->value = COLOR_DEPTH;                           // Bits per pixel
+
+  volatile MboxWord *order = MBOX_ADD(&msg, SETPXLORDR);  // Set pixel order
+  order->value = PIXEL_ORDER;
+
+  volatile MboxRange *fbInfo = MBOX_ADD(&msg, GETFB);  // Get frame buffer
+  fbInfo->base = 16;  // alignment in 16 bytes, will return the address
+
+  volatile MboxWord *fbPitch = MBOX_ADD(&msg, GETPITCH);  // Will get pitch value here
+
+#if COLOR_DEPTH == 8
+  // Load the 16 game colors into the GPU palette
+  volatile MboxPalette16 *pal = MBOX_ADD(&msg, SETPALETTE);
+  pal->first = 0;
+  pal->count = 16;
+  for (int i = 0; i < 16; i++)
+    pal->colors[i] = vgapal[i];
+#endif
+
+  mbox_addSysInfo(&msg);
 
   // Call Mailbox
-  if (mbox_call(ADDR(mBuf), MBOX_CH_PROP)  // mailbox call is successful ?
-      &&
-      mBuf[20] == COLOR_DEPTH  // got correct color depth ?
+  int ok = mbox_send(&msg);  // mailbox call is successful ?
+  mbox_readSysInfo();
+
+  if (ok &&
+      depth->value == COLOR_DEPTH  // got correct color depth ?
       &&
-      mBuf[24] == PIXEL_ORDER  // got correct pixel order ?
+      order->value == PIXEL_ORDER  // got correct pixel order ?
       &&
-      mBuf[28] != 0  // got a valid address for frame buffer ?
+      fbInfo->base != 0  // got a valid address for frame buffer ?
   ) {
     /* Convert GPU address to ARM address (clear higher address bits) * Frame Buffer is located in RAM memory, which VideoCore MMU
      * maps it to bus address space starting at 0xC0000000.
      * Software accessing RAM directly use physical addresses
      * (based at 0x00000000)
      */
-    mBuf[28] &= 0x3FFFFFFF;
-
     // Access frame buffer as 1 byte per each address
-    fb = (unsigned char *)((unsigned long)mBuf[28]);
-    // uart_puts("Got allocated Frame Buffer at RAM physical address: ");
-    // uart_hex(mBuf[28]);
-    // uart_puts("\n");
-
+    fbBase = (unsigned char *)((unsigned long)(fbInfo->base & 0x3FFFFFFF));
     // uart_puts("Frame Buffer Size (bytes): ");
-    // uart_dec(mBuf[29]);
+    // uart_dec(fbInfo->size);
     // uart_puts("\n");
 
-    width = mBuf[5];   // Actual physical width
-    height = mBuf[6];  // Actual physical height
-    pitch = mBuf[33];  // Number of bytes per line
+    width = phys->width;          // Actual physical width
+    height = phys->height;        // Actual physical height
+    screenPitch = fbPitch->value;  // Number of bytes per line
+
+    // The GPU may give us fewer pages than requested if memory is short
+    numPages = virt->height / height;
+    if (numPages > FB_BUFFERS)
+      numPages = FB_BUFFERS;
+    if (numPages < 1)
+      numPages = 1;
+
+    // Page 0 is being scanned out, start drawing on the next one
+    backPage = (numPages > 1) ? 1 : 0;
+    backBuffer = fbBase + backPage * height * screenPitch;
+    framebf_resetTarget();
+
+    fbDma = dma_alloc();
+
+#if COLOR_DEPTH == 8
+    // The GPU answers 0 in the first value word when the palette is valid
+    if (pal->first != 0)
+      uart_puts("Unable to set the palette\n");
+#endif
   } else {
     uart_puts("Unable to get a frame buffer with provided settings\n");
   }
 }
 
+// Wait for the page flip in flight, if any
+static void finishFlip() {
+  if (flipHandle < 0)
+    return;
+
+  if (!mbox_wait(flipHandle))
+    uart_puts("Unable to flip frame buffer pages\n");
+  mbox_release(flipHandle);
+  flipHandle = -1;
+}
+
+// Show the back buffer on screen and move drawing to the next page
+// Does nothing when running single buffered. The flip is sent without
+// waiting when there are 3 or more pages: the next back page is then
+// neither on screen nor about to be
+void framebf_present() {
+  volatile unsigned int *msg;
+  MboxMsg flip;
+
+  if (numPages < 2)
+    return;
+
+  // One flip in flight at a time
+  finishFlip();
+
+  msg = mbox_get();
+  if (!msg) {
+    uart_puts("Unable to flip frame buffer pages\n");
+    return;
+  }
+
+  mbox_start(&flip, msg);
+  MBOX_ADD(&flip, SETVIRTOFF)->y = backPage * height;  // y offset of the finished page
+  mbox_finish(&flip);
+
+  flipHandle = mbox_submit(msg, MBOX_CH_PROP);
+
+  // Double buffered: the next back page stays on screen until the flip
+  if (numPages < 3)
+    finishFlip();
+
+  backPage = (backPage + 1) % numPages;
+  backBuffer = fbBase + backPage * height * screenPitch;
+  if (!offscreen)
+    drawTarget()->buf = backBuffer;
+}
+
+// Start a new clip stack covering a whole w x h surface
+static void resetClip(DrawTarget *t, int w, int h) {
+  clipDepth = 0;
+  clipStack[0].x1 = 0;
+  clipStack[0].y1 = 0;
+  clipStack[0].x2 = w - 1;
+  clipStack[0].y2 = h - 1;
+  t->clipRect = clipStack[0];
+}
+
+// Load count palette entries (0x00RRGGBB) starting at index first, in
+// one mailbox call. Only has a visible effect in 8-bit mode, where it can
+// be used to animate colors. Returns 0 on failure
+int framebf_setPalette(int first, int count, unsigned int *colors) {
+  if (first < 0 || count < 1 || count > PALETTE_MAX_BATCH || first + count > 256)
+    return 0;
+
+  MboxMsg msg;
+  mbox_start(&msg, mBuf);
+
+  // Set palette: first index, number of entries, then the entries
+  volatile unsigned int *pal = mbox_addTag(&msg, MBOX_TAG_SETPALETTE, (2 + count) * 4);
+  pal[0] = first;
+  pal[1] = count;
+  for (int i = 0; i < count; i++)
+    pal[2 + i] = colors[i];
+
+  // The GPU answers 0 in the first value word when the palette is valid
+  return mbox_send(&msg) && pal[0] == 0;
+}
+
+// Draw into a w x h off-screen surface instead of the back buffer
+// The clip stack starts over with the whole surface
+void framebf_setTarget(unsigned char *buf, unsigned int bufPitch, int w, int h) {
+  DrawTarget *t = drawTarget();
+
+  t->buf = buf;
+  t->bufPitch = bufPitch;
+  offscreen = 1;
+  resetClip(t, w, h);
+}
+
+// Go back to drawing into the back buffer, with the whole screen as clip
+void framebf_resetTarget() {
+  DrawTarget *t = drawTarget();
+
+  t->buf = backBuffer;
+  t->bufPitch = screenPitch;
+  offscreen = 0;
+  resetClip(t, width, height);
+}
+
+// Restrict drawing to a region (inclusive bounds) inside the current one
+// Returns 0 if the stack is full, the clip rectangle is then unchanged
+int framebf_pushClip(int x1, int y1, int x2, int y2) {
+  DrawTarget *t = drawTarget();
+
+  if (clipDepth == CLIP_STACK_DEPTH - 1)
+    return 0;
+
+  clipDepth++;
+  clipStack[clipDepth].x1 = MAX(x1, t->clipRect.x1);
+  clipStack[clipDepth].y1 = MAX(y1, t->clipRect.y1);
+  clipStack[clipDepth].x2 = MIN(x2, t->clipRect.x2);
+  clipStack[clipDepth].y2 = MIN(y2, t->clipRect.y2);
+  t->clipRect = clipStack[clipDepth];
+  return 1;
+}
+
+// Go back to the previous clip region (the whole surface is never popped)
+void framebf_popClip() {
+  if (clipDepth > 0)
+    clipDepth--;
+  drawTarget()->clipRect = clipStack[clipDepth];
+}
+
+// Is the box (inclusive bounds) completely outside the clip rectangle?
+// An empty clip rectangle (a pushed region outside the current one)
+// rejects everything
+static int clipReject(DrawTarget *t, int x1, int y1, int x2, int y2) {
+  ClipRect *c = &t->clipRect;
+  return x2 < c->x1 || x1 > c->x2 || y2 < c->y1 || y1 > c->y2 || c->x1 > c->x2 || c->y1 > c->y2;
+}
+
+// Is the box (inclusive bounds) completely inside the clip rectangle?
+static int clipInside(DrawTarget *t, int x1, int y1, int x2, int y2) {
+  ClipRect *c = &t->clipRect;
+  return x1 >= c->x1 && x2 <= c->x2 && y1 >= c->y1 && y2 <= c->y2;
+}
+
 void drawPixel(int x, int y, unsigned char attr) {
-  int offs = (y * pitch) + (x * 4);
-  *((unsigned int *)(fb + offs)) = vgapal[attr & 0x0f];
+  DrawTarget *t = drawTarget();
+
+  if (tileBinning) {
+    DrawCmd cmd = {CMD_PIXEL, attr, {x, y}};
+    if (tile_record(&cmd, x, y, x, y))
+      return;
+  }
+
+  if (!clipInside(t, x, y, x, y))
+    return;
+
+  int offs = (y * t->bufPitch) + (x * BYTES_PER_PIXEL);
+  *((pixel_t *)(t->buf + offs)) = palette[attr & 0x0f];
+}
+
+// Fill len pixels of row y starting at x with an already resolved color
+// The body of the span is written with 64-bit stores, which the compiler
+// pairs into 128-bit stp instructions
+static void fillSpan(DrawTarget *t, int x, int y, int len, pixel_t color) {
+  pixel_t *p = (pixel_t *)(t->buf + (y * t->bufPitch) + (x * BYTES_PER_PIXEL));
+  unsigned long wide = color * WIDE_REPEAT;
+  unsigned long *q;
+
+  if (len <= 0)
+    return;
+
+  // Align to 8 bytes first, wide stores must not be unaligned
+  while (len > 0 && ((unsigned long)p & 7)) {
+    *p++ = color;
+    len--;
+  }
+
+  q = (unsigned long *)p;
+  while (len >= 4 * PIXELS_PER_WORD) {
+    q[0] = wide;
+    q[1] = wide;
+    q[2] = wide;
+    q[3] = wide;
+    q += 4;
+    len -= 4 * PIXELS_PER_WORD;
+  }
+  while (len >= PIXELS_PER_WORD) {
+    *q++ = wide;
+    len -= PIXELS_PER_WORD;
+  }
+
+  // Pixels left at the end
+  p = (pixel_t *)q;
+  while (len-- > 0)
+    *p++ = color;
+}
+
+// Fill a w x h block of pixels with an already resolved color
+static void fillBlock(DrawTarget *t, int x, int y, int w, int h, pixel_t color) {
+  while (h-- > 0)
+    fillSpan(t, x, y++, w, color);
+}
+
+// Fill rows y1..y2 of column x, stepping down one pitch at a time
+static void fillColumn(DrawTarget *t, int x, int y1, int y2, pixel_t color) {
+  unsigned char *p = t->buf + (y1 * t->bufPitch) + (x * BYTES_PER_PIXEL);
+
+  for (int y = y1; y <= y2; y++) {
+    *(pixel_t *)p = color;
+    p += t->bufPitch;
+  }
+}
+
+// Same as the three above, trimmed to the clip rectangle first
+static void clipSpan(DrawTarget *t, int x, int y, int len, pixel_t color) {
+  if (y < t->clipRect.y1 || y > t->clipRect.y2)
+    return;
+
+  int x2 = MIN(x + len - 1, t->clipRect.x2);
+  x = MAX(x, t->clipRect.x1);
+  fillSpan(t, x, y, x2 - x + 1, color);
+}
+
+static void clipBlock(DrawTarget *t, int x, int y, int w, int h, pixel_t color) {
+  int x2 = MIN(x + w - 1, t->clipRect.x2);
+  int y2 = MIN(y + h - 1, t->clipRect.y2);
+  x = MAX(x, t->clipRect.x1);
+  y = MAX(y, t->clipRect.y1);
+  fillBlock(t, x, y, x2 - x + 1, y2 - y + 1, color);
+}
+
+static void clipColumn(DrawTarget *t, int x, int y1, int y2, pixel_t color) {
+  if (x < t->clipRect.x1 || x > t->clipRect.x2)
+    return;
+
+  fillColumn(t, x, MAX(y1, t->clipRect.y1), MIN(y2, t->clipRect.y2), color);
 }
 
 // Attribute color is a HEX code
@@ -107,87 +413,357 @@ void drawPixel(int x, int y, unsigned char attr) {
 // For example, attr=0x03 => 0 background (BLACK), 3 foreground (GREEN)
 // See color indexes in vgapl array (terminal.h), there is a 16-color pallete
 void drawRect(int x1, int y1, int x2, int y2, unsigned char attr, int fill) {
-  int y = y1;
-
-  while (y <= y2) {
-    int x = x1;
-    while (x <= x2) {
-      if ((x == x1 || x == x2) || (y == y1 || y == y2))
-        drawPixel(x, y, attr);
-      else if (fill)
-        drawPixel(x, y, (attr & 0xf0) >> 4);
-      x++;
-    }
-    y++;
+  DrawTarget *t = drawTarget();
+  pixel_t outline = palette[attr & 0x0f];
+  pixel_t inside = palette[(attr & 0xf0) >> 4];
+  int w = x2 - x1 + 1;
+  int h = y2 - y1 + 1;
+
+  if (tileBinning) {
+    DrawCmd cmd = {CMD_RECT, attr, {x1, y1, x2, y2, fill}};
+    if (tile_record(&cmd, x1, y1, x2, y2))
+      return;
+  }
+
+  if (w <= 0 || h <= 0 || clipReject(t, x1, y1, x2, y2))
+    return;
+
+  // Same color inside and out: one solid block
+  if (fill && outline == inside) {
+    clipBlock(t, x1, y1, w, h, inside);
+    return;
   }
+
+  // Top and bottom edges
+  clipSpan(t, x1, y1, w, outline);
+  if (h > 1)
+    clipSpan(t, x1, y2, w, outline);
+
+  // Inside rows
+  if (fill && w > 2)
+    clipBlock(t, x1 + 1, y1 + 1, w - 2, h - 2, inside);
+
+  // Left and right edges
+  clipColumn(t, x1, y1 + 1, y2 - 1, outline);
+  if (w > 1)
+    clipColumn(t, x2, y1 + 1, y2 - 1, outline);
 }
 
+// Draw a line from (x1, y1) to (x2, y2), both ends included, in any direction
 void drawLine(int x1, int y1, int x2, int y2, unsigned char attr) {
-  int dx, dy, p, x, y;
-
-  dx = x2 - x1;
-  dy = y2 - y1;
-  x = x1;
-  y = y1;
-  p = 2 * dy - dx;
-
-  while (x < x2) {
-    if (p >= 0) {
-      drawPixel(x, y, attr);
-      y++;
-      p = p + 2 * dy - 2 * dx;
-    } else {
-      drawPixel(x, y, attr);
-      p = p + 2 * dy;
+  DrawTarget *t = drawTarget();
+  pixel_t color = palette[attr & 0x0f];
+  int swap;
+
+  if (tileBinning) {
+    DrawCmd cmd = {CMD_LINE, attr, {x1, y1, x2, y2}};
+    if (tile_record(&cmd, MIN(x1, x2), MIN(y1, y2), MAX(x1, x2), MAX(y1, y2)))
+      return;
+  }
+
+  // Horizontal: a single span
+  if (y1 == y2) {
+    if (x1 > x2) {
+      swap = x1, x1 = x2, x2 = swap;
+    }
+    clipSpan(t, x1, y1, x2 - x1 + 1, color);
+    return;
+  }
+
+  // Vertical: step down one pitch at a time
+  if (x1 == x2) {
+    if (y1 > y2) {
+      swap = y1, y1 = y2, y2 = swap;
+    }
+    clipColumn(t, x1, y1, y2, color);
+    return;
+  }
+
+  if (clipReject(t, MIN(x1, x2), MIN(y1, y2), MAX(x1, x2), MAX(y1, y2)))
+    return;
+
+  // Anything else: Bresenham for all octants, moving a pointer by
+  // one pixel and/or one pitch instead of recomputing each offset.
+  // Only lines crossing the clip edge test their pixels one by one
+  ClipRect *c = &t->clipRect;
+  int inside = clipInside(t, MIN(x1, x2), MIN(y1, y2), MAX(x1, x2), MAX(y1, y2));
+  int dx = (x2 > x1) ? x2 - x1 : x1 - x2;
+  int dy = (y2 > y1) ? y1 - y2 : y2 - y1;  // negative
+  int stepx = (x2 > x1) ? BYTES_PER_PIXEL : -BYTES_PER_PIXEL;
+  long stepy = (y2 > y1) ? (long)t->bufPitch : -(long)t->bufPitch;
+  int steps = (dx > -dy) ? dx : -dy;
+  int err = dx + dy;
+  // The start may lie outside the surface (above it), keep the offset signed
+  unsigned char *p = t->buf + ((long)y1 * t->bufPitch) + (x1 * BYTES_PER_PIXEL);
+
+  int x = x1, y = y1;
+
+  for (int i = 0; i <= steps; i++) {
+    if (inside || (x >= c->x1 && x <= c->x2 && y >= c->y1 && y <= c->y2))
+      *(pixel_t *)p = color;
+
+    int e2 = 2 * err;
+    if (e2 >= dy) {
+      err += dy;
+      p += stepx;
+      x += (stepx > 0) ? 1 : -1;
+    }
+    if (e2 <= dx) {
+      err += dx;
+      p += stepy;
+      y += (stepy > 0) ? 1 : -1;
     }
-    x++;
   }
 }
 
-void drawCircle(int x0, int y0, int radius, unsigned char attr, int fill) {
-  int x = radius;
-  int y = 0;
-  int err = 0;
-
-  while (x >= y) {
-    if (fill) {
-      drawLine(x0 - y, y0 + x, x0 + y, y0 + x, (attr & 0xf0) >> 4);
-      drawLine(x0 - x, y0 + y, x0 + x, y0 + y, (attr & 0xf0) >> 4);
-      drawLine(x0 - x, y0 - y, x0 + x, y0 - y, (attr & 0xf0) >> 4);
-      drawLine(x0 - y, y0 - x, x0 + y, y0 - x, (attr & 0xf0) >> 4);
+// Ellipses are drawn one scanline at a time from a table of half widths:
+// hw[dy] is the largest x with (x/rx)^2 + (dy/ry)^2 <= 1 (plus a little
+// slack so edges look round), and hw[ry + 1] = -1.
+// Tables for small radii are kept in a tiny cache, bullets reuse them
+#define SPAN_CACHE_ENTRIES 4
+#define SPAN_CACHE_MAX_R 16
+#define ELLIPSE_MAX_R HEIGHT
+
+struct SpanTable {
+  int used;
+  int rx;
+  int ry;
+  short hw[SPAN_CACHE_MAX_R + 2];
+};
+
+struct SpanTable spanCache[SPAN_CACHE_ENTRIES];
+int spanCacheNext = 0;
+
+static void ellipseHalfWidths(int rx, int ry, short *hw) {
+  long a2 = (long)rx * rx, b2 = (long)ry * ry;
+  long limit = a2 * b2 + (long)rx * ry * (rx > ry ? rx : ry);
+  long x = rx;
+
+  for (long dy = 0; dy <= ry; dy++) {
+    while (x > 0 && x * x * b2 + dy * dy * a2 > limit)
+      x--;
+    hw[dy] = x;
+  }
+  hw[ry + 1] = -1;
+}
+
+// Get the half width table of a small ellipse, computing it on first use
+// While tiles are rendered in parallel the cache is read only, a miss is
+// computed into buf instead
+static const short *spanTable(int rx, int ry, short *buf) {
+  struct SpanTable *table;
+
+  for (int i = 0; i < SPAN_CACHE_ENTRIES; i++) {
+    if (spanCache[i].used && spanCache[i].rx == rx && spanCache[i].ry == ry)
+      return spanCache[i].hw;
+  }
+
+  if (tileReplaying) {
+    ellipseHalfWidths(rx, ry, buf);
+    return buf;
+  }
+
+  table = &spanCache[spanCacheNext];
+  spanCacheNext = (spanCacheNext + 1) % SPAN_CACHE_ENTRIES;
+  ellipseHalfWidths(rx, ry, table->hw);
+  table->rx = rx;
+  table->ry = ry;
+  table->used = 1;
+
+  return table->hw;
+}
+
+// Draw one row of an ellipse: the outline is what the next row out
+// does not cover, the inside is filled only if asked. Every pixel is
+// written exactly once
+static void ellipseRow(DrawTarget *t, int x0, int y, int outer, int next, pixel_t outline, pixel_t inside, int fill) {
+  int inner = (next < outer - 1) ? next : outer - 1;
+
+  if (y < t->clipRect.y1 || y > t->clipRect.y2)
+    return;
+
+  if (inner < 0) {
+    clipSpan(t, x0 - outer, y, 2 * outer + 1, outline);
+    return;
+  }
+
+  clipSpan(t, x0 - outer, y, outer - inner, outline);
+  if (fill)
+    clipSpan(t, x0 - inner, y, 2 * inner + 1, inside);
+  clipSpan(t, x0 + inner + 1, y, outer - inner, outline);
+}
+
+// Attribute color works as in drawRect(): 4 LSBs outline, 4 MSBs fill
+void drawEllipse(int x0, int y0, int rx, int ry, unsigned char attr, int fill) {
+  DrawTarget *t = drawTarget();
+  pixel_t outline = palette[attr & 0x0f];
+  pixel_t inside = palette[(attr & 0xf0) >> 4];
+  short big[ELLIPSE_MAX_R + 2];
+  const short *hw;
+
+  if (rx < 0 || ry < 0 || rx > ELLIPSE_MAX_R || ry > ELLIPSE_MAX_R)
+    return;
+
+  if (tileBinning) {
+    DrawCmd cmd = {CMD_ELLIPSE, attr, {x0, y0, rx, ry, fill}};
+    if (tile_record(&cmd, x0 - rx, y0 - ry, x0 + rx, y0 + ry)) {
+      // Fill the span cache now, it is read only while tiles are drawn
+      if (rx <= SPAN_CACHE_MAX_R && ry <= SPAN_CACHE_MAX_R)
+        spanTable(rx, ry, big);
+      return;
     }
-    drawPixel(x0 - y, y0 + x, attr);
-    drawPixel(x0 + y, y0 + x, attr);
-    drawPixel(x0 - x, y0 + y, attr);
-    drawPixel(x0 + x, y0 + y, attr);
-    drawPixel(x0 - x, y0 - y, attr);
-    drawPixel(x0 + x, y0 - y, attr);
-    drawPixel(x0 - y, y0 - x, attr);
-    drawPixel(x0 + y, y0 - x, attr);
-
-    if (err <= 0) {
-      y += 1;
-      err += 2 * y + 1;
+  }
+
+  if (clipReject(t, x0 - rx, y0 - ry, x0 + rx, y0 + ry))
+    return;
+
+  if (rx <= SPAN_CACHE_MAX_R && ry <= SPAN_CACHE_MAX_R) {
+    hw = spanTable(rx, ry, big);
+  } else {
+    ellipseHalfWidths(rx, ry, big);
+    hw = big;
+  }
+
+  // Middle row, then the rows above and below it in pairs
+  ellipseRow(t, x0, y0, hw[0], hw[1], outline, inside, fill);
+  for (int dy = 1; dy <= ry; dy++) {
+    ellipseRow(t, x0, y0 - dy, hw[dy], hw[dy + 1], outline, inside, fill);
+    ellipseRow(t, x0, y0 + dy, hw[dy], hw[dy + 1], outline, inside, fill);
+  }
+}
+
+void drawCircle(int x0, int y0, int radius, unsigned char attr, int fill) {
+  drawEllipse(x0, y0, radius, radius, attr, fill);
+}
+
+// Glyph cache: every entry holds the FONT_HEIGHT distinct rows of one
+// (glyph, zoom, attr) combination, already expanded to pixels.
+// Entries are grouped in small sets, a full set replaces its oldest entry
+#define GLYPH_CACHE_SETS 32
+#define GLYPH_CACHE_WAYS 4
+#define GLYPH_CACHE_MAX_ZOOM 6
+
+struct GlyphEntry {
+  unsigned int key;  // 0 = empty, see glyphKey()
+  pixel_t rows[FONT_HEIGHT][FONT_WIDTH * GLYPH_CACHE_MAX_ZOOM];
+};
+
+struct GlyphEntry glyphCache[GLYPH_CACHE_SETS][GLYPH_CACHE_WAYS];
+unsigned char glyphCacheNext[GLYPH_CACHE_SETS];  // next way to replace in each set
+unsigned int glyphCacheHits, glyphCacheMisses;
+
+// Zoom is never 0 in the cache, so a valid key is never 0
+static unsigned int glyphKey(unsigned char ch, unsigned char attr, int zoom) {
+  return ((unsigned int)ch << 16) | ((unsigned int)zoom << 8) | attr;
+}
+
+// Find the expanded rows of a glyph, rasterizing them on a miss
+// While tiles are rendered in parallel the cache is read only and a miss
+// returns 0 (the statistics are not updated either)
+static struct GlyphEntry *glyphLookup(unsigned char ch, unsigned char attr, int zoom) {
+  unsigned int key = glyphKey(ch, attr, zoom);
+  unsigned int set = (ch ^ (attr * 7) ^ (zoom * 13)) % GLYPH_CACHE_SETS;
+  struct GlyphEntry *entry;
+
+  for (int way = 0; way < GLYPH_CACHE_WAYS; way++) {
+    if (glyphCache[set][way].key == key) {
+      if (!tileReplaying)
+        glyphCacheHits++;
+      return &glyphCache[set][way];
     }
+  }
+
+  if (tileReplaying)
+    return 0;
+
+  glyphCacheMisses++;
+  entry = &glyphCache[set][glyphCacheNext[set]];
+  glyphCacheNext[set] = (glyphCacheNext[set] + 1) % GLYPH_CACHE_WAYS;
 
-    if (err > 0) {
-      x -= 1;
-      err -= 2 * x + 1;
+  pixel_t fg = palette[attr & 0x0f];
+  pixel_t bg = palette[(attr & 0xf0) >> 4];
+  unsigned char *glyph = (unsigned char *)&font + ch * FONT_BPG;
+
+  for (int row = 0; row < FONT_HEIGHT; row++, glyph += FONT_BPL) {
+    pixel_t *pixel = entry->rows[row];
+    for (int col = 0; col < FONT_WIDTH; col++) {
+      pixel_t color = (*glyph & (1 << col)) ? fg : bg;
+      for (int z = 0; z < zoom; z++)
+        *pixel++ = color;
     }
   }
+  entry->key = key;
+
+  return entry;
+}
+
+// Get glyph cache statistics (any pointer may be 0)
+void glyphCacheStats(unsigned int *hits, unsigned int *misses) {
+  if (hits)
+    *hits = glyphCacheHits;
+  if (misses)
+    *misses = glyphCacheMisses;
 }
 
 void drawChar(unsigned char ch, int x, int y, unsigned char attr, int zoom) {
-  unsigned char *glyph = (unsigned char *)&font + (ch < FONT_NUMGLYPHS ? ch : 0) * FONT_BPG;
+  DrawTarget *t = drawTarget();
+  int w = FONT_WIDTH * zoom, h = FONT_HEIGHT * zoom;
+  int top = y + 1;  // glyphs start one line below y
+
+  struct GlyphEntry *entry = 0;
+
+  if (ch >= FONT_NUMGLYPHS)
+    ch = 0;
+
+  if (zoom < 1)
+    return;
+
+  if (tileBinning) {
+    DrawCmd cmd = {CMD_CHAR, attr, {ch, x, y, zoom}};
+    if (tile_record(&cmd, x, top, x + w - 1, top + h - 1)) {
+      // Fill the glyph cache now, it is read only while tiles are drawn
+      if (zoom <= GLYPH_CACHE_MAX_ZOOM)
+        glyphLookup(ch, attr, zoom);
+      return;
+    }
+  }
+
+  if (clipReject(t, x, top, x + w - 1, top + h - 1))
+    return;
+
+  if (zoom <= GLYPH_CACHE_MAX_ZOOM)
+    entry = glyphLookup(ch, attr, zoom);
 
-  for (int i = 1; i <= (FONT_HEIGHT * zoom); i++) {
-    for (int j = 0; j < (FONT_WIDTH * zoom); j++) {
-      unsigned char mask = 1 << (j / zoom);
-      unsigned char col = (*glyph & mask) ? attr & 0x0f : (attr & 0xf0) >> 4;
+  // Too big for the cache (or evicted while drawing tiles): draw each
+  // texel as a zoom x zoom block
+  if (!entry) {
+    unsigned char *glyph = (unsigned char *)&font + ch * FONT_BPG;
 
-      drawPixel(x + j, y + i, col);
+    for (int row = 0; row < FONT_HEIGHT; row++, glyph += FONT_BPL) {
+      for (int col = 0; col < FONT_WIDTH; col++) {
+        unsigned char c = (*glyph & (1 << col)) ? attr & 0x0f : (attr & 0xf0) >> 4;
+        clipBlock(t, x + col * zoom, top + row * zoom, zoom, zoom, palette[c]);
+      }
+    }
+    return;
+  }
+
+  // Columns and lines of the glyph left after clipping
+  int first = MAX(t->clipRect.x1 - x, 0), last = MIN(t->clipRect.x2 - x, w - 1);
+  int line = MAX(t->clipRect.y1 - top, 0), lastLine = MIN(t->clipRect.y2 - top, h - 1);
+
+  // Copy each cached row zoom times
+  unsigned char *dst = t->buf + ((top + line) * t->bufPitch) + ((x + first) * BYTES_PER_PIXEL);
+  unsigned int rowBytes = (last - first + 1) * BYTES_PER_PIXEL;
+  int row = line / zoom, z = line % zoom;
+
+  for (; line <= lastLine; line++) {
+    blitCopy(dst, (unsigned char *)&entry->rows[row][first], rowBytes);
+    dst += t->bufPitch;
+    if (++z == zoom) {
+      z = 0;
+      row++;
     }
-    glyph += (i % zoom) ? 0 : FONT_BPL;
   }
 }
 
@@ -206,37 +782,103 @@ void drawString(int x, int y, char *s, unsigned char attr, int zoom) {
   }
 }
 
+// Is a rectangle of rows x rowBytes all in the frame buffer pages? That
+// memory is not cached, so the DMA engine can work on it directly
+static int inFrameBuffer(unsigned char *p, unsigned int surfacePitch, unsigned int rowBytes, unsigned int rows) {
+  unsigned char *end = p + (rows - 1) * (unsigned long)surfacePitch + rowBytes;
+  return p >= fbBase && end <= fbBase + numPages * height * screenPitch;
+}
+
+// Copy a rectangle within the surface drawn on by DMA, and wait for it
+// Returns 0 if the CPU has to do it
+static int dmaCopy(DrawTarget *t, unsigned char *dst, unsigned char *src, unsigned int rowBytes, unsigned int rows) {
+  if (fbDma < 0 || rowBytes * rows < DMA_MIN_BYTES ||
+      !inFrameBuffer(dst, t->bufPitch, rowBytes, rows) || !inFrameBuffer(src, t->bufPitch, rowBytes, rows))
+    return 0;
+
+  if (!dma_blit2d(fbDma, dst, t->bufPitch, src, t->bufPitch, rowBytes, rows))
+    return 0;
+  dma_start(fbDma);
+  return dma_wait(fbDma);
+}
+
+// Queue a fill of box (already clipped) on a frame buffer surface with
+// palette color, run by dma_start(fbDma). Returns 0 if the CPU has to do
+// it: too small, not in the frame buffer or not word aligned
+int framebf_queueFill(unsigned char *surface, unsigned int surfacePitch, ClipRect *box, int color) {
+  unsigned char *dst = surface + (box->y1 * surfacePitch) + (box->x1 * BYTES_PER_PIXEL);
+  unsigned int rowBytes = (box->x2 - box->x1 + 1) * BYTES_PER_PIXEL;
+  unsigned int rows = box->y2 - box->y1 + 1;
+
+  if (fbDma < 0 || rowBytes * rows < DMA_MIN_BYTES || !inFrameBuffer(dst, surfacePitch, rowBytes, rows))
+    return 0;
+
+  return dma_fill(fbDma, dst, surfacePitch, rowBytes, rows, (unsigned int)(palette[color] * WIDE_REPEAT));
+}
+
 void moveRect(int oldx, int oldy, int width, int height, int shiftx, int shifty, unsigned char attr) {
-  unsigned int newx = oldx + shiftx, newy = oldy + shifty;
-  unsigned int xcount = 0, ycount = 0;
-  unsigned int bitmap[width][height];  // This is very unsafe if it's too big for the stack...
-  unsigned int offs;
-
-  // Copy current screen to bitmap array
-  while (xcount < width) {
-    while (ycount < height) {
-      offs = ((oldy + ycount) * pitch) + ((oldx + xcount) * 4);
-
-      bitmap[xcount][ycount] = *((unsigned int *)(fb + offs));
-      ycount++;
-    }
-    ycount = 0;
-    xcount++;
+  DrawTarget *t = drawTarget();
+  int newx = oldx + shiftx, newy = oldy + shifty;
+  pixel_t erase = palette[(attr & 0xf0) >> 4];
+
+  // Moves pixels already drawn, so everything binned so far goes first
+  if (tileBinning)
+    tile_flush();
+
+  // Only pixels whose source and destination are both inside the clip
+  // rectangle are moved, in place, the blitter deals with the overlap
+  int x1 = MAX(newx, MAX(t->clipRect.x1, t->clipRect.x1 + shiftx));
+  int y1 = MAX(newy, MAX(t->clipRect.y1, t->clipRect.y1 + shifty));
+  int x2 = MIN(newx + width - 1, MIN(t->clipRect.x2, t->clipRect.x2 + shiftx));
+  int y2 = MIN(newy + height - 1, MIN(t->clipRect.y2, t->clipRect.y2 + shifty));
+  if (x1 <= x2 && y1 <= y2) {
+    unsigned char *dst = t->buf + (y1 * t->bufPitch) + (x1 * BYTES_PER_PIXEL);
+    unsigned char *src = t->buf + ((y1 - shifty) * t->bufPitch) + ((x1 - shiftx) * BYTES_PER_PIXEL);
+    unsigned int rowBytes = (x2 - x1 + 1) * BYTES_PER_PIXEL;
+
+    // The old rectangle is erased below, the copy must be done by then
+    if (!dmaCopy(t, dst, src, rowBytes, y2 - y1 + 1))
+      blitRect(dst, t->bufPitch, src, t->bufPitch, rowBytes, y2 - y1 + 1);
   }
 
-  // "Delete" object (draw a black shape)
-  drawRect(oldx, oldy, oldx + width, oldy + width, attr, 1);
-
-  // Redraw bitmap
-  for (int i = newx; i < newx + width; i++) {
-    for (int j = newy; j < newy + height; j++) {
-      offs = (j * pitch) + (i * 4);
-      *((unsigned int *)(fb + offs)) = bitmap[i - newx][j - newy];
-    }
+  // "Delete" the part of the old rectangle that is not covered by the new one
+  int top = (newy > oldy) ? newy : oldy;                // first row both share
+  int bottom = ((newy < oldy) ? newy : oldy) + height;  // end of shared rows
+  if (bottom <= top || shiftx >= width || -shiftx >= width) {
+    clipBlock(t, oldx, oldy, width, height, erase);
+    return;
   }
+
+  // Rows left behind above (moved down) or below (moved up)
+  if (top > oldy)
+    clipBlock(t, oldx, oldy, width, top - oldy, erase);
+  if (bottom < oldy + height)
+    clipBlock(t, oldx, bottom, width, oldy + height - bottom, erase);
+
+  // Columns left behind on the shared rows
+  if (shiftx > 0)
+    clipBlock(t, oldx, top, shiftx, bottom - top, erase);
+  else if (shiftx < 0)
+    clipBlock(t, newx + width, top, -shiftx, bottom - top, erase);
 }
 
 // Clear the screen
 void clearScreen(int width, int height) {
-  drawRect(0, 0, width, height, 0x00, 1);
+  DrawTarget *t = drawTarget();
+
+  if (tileBinning) {
+    DrawCmd cmd = {CMD_CLEAR, 0x00, {width, height}};
+    if (tile_record(&cmd, 0, 0, width - 1, height - 1))
+      return;
+  }
+
+  ClipRect *c = &t->clipRect;
+  ClipRect box = {MAX(c->x1, 0), MAX(c->y1, 0), MIN(c->x2, width - 1), MIN(c->y2, height - 1)};
+  if (box.x1 <= box.x2 && box.y1 <= box.y2 && framebf_queueFill(t->buf, t->bufPitch, &box, 0)) {
+    dma_start(fbDma);
+    dma_wait(fbDma);  // whatever is drawn next goes on top
+    return;
+  }
+
+  clipBlock(t, 0, 0, width, height, palette[0]);
 }
\ No newline at end of file
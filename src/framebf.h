@@ -5,12 +5,82 @@
 #define MARGIN 20
 #define VIRTWIDTH (WIDTH - (2 * MARGIN))
 
+// Pages in the virtual frame buffer: 1 = single, 2 = double, 3 = triple buffered
+#ifndef FB_BUFFERS
+#define FB_BUFFERS 2
+#endif
+
+// Bits per pixel: 8 (paletted), 16 (RGB565) or 32
+#ifndef COLOR_DEPTH
+#define COLOR_DEPTH 32
+#endif
+
+#if COLOR_DEPTH == 8
+typedef unsigned char pixel_t;
+#elif COLOR_DEPTH == 16
+typedef unsigned short pixel_t;
+#elif COLOR_DEPTH == 32
+typedef unsigned int pixel_t;
+#else
+#error "COLOR_DEPTH must be 8, 16 or 32"
+#endif
+
+#define BYTES_PER_PIXEL (COLOR_DEPTH / 8)
+
+// Clip rectangle, bounds are inclusive
+typedef struct {
+  int x1;
+  int y1;
+  int x2;
+  int y2;
+} ClipRect;
+
+// Cores that may draw at the same time (the tile renderer uses all of them)
+#define DRAW_CORES 4
+
+// Surface currently drawn on (back buffer, off-screen or a tile buffer), its
+// bytes per line and the clip rectangle every primitive is trimmed to.
+// Each core has its own, drawing calls fetch the calling core's with drawTarget()
+typedef struct {
+  unsigned char *buf;
+  unsigned int bufPitch;
+  ClipRect clipRect;
+} __attribute__((aligned(64))) DrawTarget;  // one cache line per core
+
+extern DrawTarget drawTargets[DRAW_CORES];
+
+// Number of the calling core. Not volatile: it never changes, so the
+// compiler may read it once per function
+static inline int drawCore() {
+  unsigned long mpidr;
+  asm("mrs %0, mpidr_el1"
+      : "=r"(mpidr));
+  return mpidr & (DRAW_CORES - 1);
+}
+
+// The calling core's surface, clip rectangle included
+static inline DrawTarget *drawTarget() {
+  return &drawTargets[drawCore()];
+}
+
+// DMA channel for frame buffer fills and copies, -1 if none
+extern int fbDma;
+
 void framebf_init();
+void framebf_present();
+int framebf_setPalette(int first, int count, unsigned int *colors);
+void framebf_setTarget(unsigned char *buf, unsigned int bufPitch, int w, int h);
+void framebf_resetTarget();
+int framebf_pushClip(int x1, int y1, int x2, int y2);
+void framebf_popClip();
+int framebf_queueFill(unsigned char *surface, unsigned int surfacePitch, ClipRect *box, int color);
 void drawPixel(int x, int y, unsigned char attr);
 void drawChar(unsigned char ch, int x, int y, unsigned char attr, int zoom);
 void drawString(int x, int y, char *s, unsigned char attr, int zoom);
+void glyphCacheStats(unsigned int *hits, unsigned int *misses);
 void drawRect(int x1, int y1, int x2, int y2, unsigned char attr, int fill);
 void drawCircle(int x0, int y0, int radius, unsigned char attr, int fill);
+void drawEllipse(int x0, int y0, int rx, int ry, unsigned char attr, int fill);
 void drawLine(int x1, int y1, int x2, int y2, unsigned char attr);
 
 void moveRect(int oldx, int oldy, int width, int height, int shiftx, int shifty, unsigned char attr);
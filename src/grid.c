@@ -0,0 +1,159 @@
+// ----------------------------------- grid.c -------------------------------------
+#include "entity.h"
+#include "grid.h"
+#include "heap.h"
+
+// Cell column or row of a coordinate, clamped to the n there are
+static unsigned int cellOf(Grid *grid, int v, unsigned int n) {
+  if (v < 0)
+    return 0;
+  v >>= grid->cellShift;
+  return ((unsigned int)v < n) ? (unsigned int)v : n - 1;
+}
+
+// First and last cell column and row entity i touches on its way through
+// the step (from x, y to x + vx, y + vy), grown by the margin
+static void cellRange(Grid *grid, EntityStore *store, int i, unsigned int r[4]) {
+  int m = grid->margin;
+  int vx = store->vx[i], vy = store->vy[i];
+  int x1 = store->x[i] + ((vx < 0) ? vx : 0) - m;
+  int y1 = store->y[i] + ((vy < 0) ? vy : 0) - m;
+  int x2 = store->x[i] + store->width[i] + ((vx > 0) ? vx : 0) + m;
+  int y2 = store->y[i] + store->height[i] + ((vy > 0) ? vy : 0) + m;
+
+  r[0] = cellOf(grid, x1, grid->cols);
+  r[1] = cellOf(grid, y1, grid->rows);
+  r[2] = cellOf(grid, x2, grid->cols);
+  r[3] = cellOf(grid, y2, grid->rows);
+}
+
+/**
+ * Cover width x height pixels with cells of 1 << cellShift pixels (about
+ * the size of a sprite), with room for capacity cell entries: entities
+ * touching several cells take one in each
+ * Returns 0 if the heap does not have the memory
+ */
+int grid_init(Grid *grid, int width, int height, unsigned int cellShift, unsigned int capacity) {
+  grid->cellShift = cellShift;
+  grid->cols = (width + (1 << cellShift) - 1) >> cellShift;
+  grid->rows = (height + (1 << cellShift) - 1) >> cellShift;
+  grid->margin = 0;
+  grid->cellStart = heap_alloc((grid->cols * grid->rows + 1) * sizeof(unsigned int));
+  grid->entries = heap_alloc(capacity * sizeof(int));
+  grid->capacity = grid->entries ? capacity : 0;
+  grid->complete = 0;
+  return grid->cellStart && grid->entries;
+}
+
+/**
+ * List every entity of the store in the cells its box touches while it
+ * moves by its velocity, grown by margin on each side. Entities that may
+ * meet during the step (or are closer than 2 * margin) share a cell
+ * The dense indices are only good until the store changes
+ * Returns 0 if the entries did not fit (grid_pairs() then tests all)
+ */
+int grid_build(Grid *grid, EntityStore *store, int margin) {
+  unsigned int cells = grid->cols * grid->rows;
+  unsigned int *start = grid->cellStart;
+  unsigned int total = 0, r[4];
+
+  grid->margin = margin;
+  grid->complete = 0;
+  if (!start)
+    return 0;
+
+  // Count the entries of each cell, one cell along
+  for (unsigned int c = 0; c <= cells; c++)
+    start[c] = 0;
+  for (unsigned int i = 0; i < store->count; i++) {
+    cellRange(grid, store, i, r);
+    for (unsigned int cy = r[1]; cy <= r[3]; cy++) {
+      for (unsigned int cx = r[0]; cx <= r[2]; cx++)
+        start[cy * grid->cols + cx + 1]++;
+    }
+    total += (r[2] - r[0] + 1) * (r[3] - r[1] + 1);
+  }
+  if (total > grid->capacity)
+    return 0;
+
+  // Where each cell's entries start
+  for (unsigned int c = 0; c < cells; c++)
+    start[c + 1] += start[c];
+
+  // Fill in, moving each cell's start to its end (the next one's start)
+  for (unsigned int i = 0; i < store->count; i++) {
+    cellRange(grid, store, i, r);
+    for (unsigned int cy = r[1]; cy <= r[3]; cy++) {
+      for (unsigned int cx = r[0]; cx <= r[2]; cx++)
+        grid->entries[start[cy * grid->cols + cx]++] = i;
+    }
+  }
+  for (unsigned int c = cells; c > 0; c--)
+    start[c] = start[c - 1];
+  start[0] = 0;
+
+  grid->complete = 1;
+  return 1;
+}
+
+// Add a pair if there is room, returns the new count
+static int addPair(GridPair *pairs, int n, int max, int a, int b) {
+  if (n < max) {
+    pairs[n].a = a;
+    pairs[n].b = b;
+    n++;
+  }
+  return n;
+}
+
+/**
+ * Candidate pairs of an entity of typeA and one of typeB that share a
+ * cell, each listed once (with the same type twice, in one order only)
+ * They still need a real test. Returns how many were put in pairs (at
+ * most max)
+ */
+int grid_pairs(Grid *grid, EntityStore *store, unsigned int typeA, unsigned int typeB, GridPair *pairs, int max) {
+  const unsigned char *type = store->type;
+  unsigned int cells = grid->cols * grid->rows;
+  unsigned int ra[4], rb[4];
+  int n = 0;
+
+  // The grid overflowed: everything against everything
+  if (!grid->complete) {
+    ENTITY_EACH(store, a, typeA) {
+      ENTITY_EACH(store, b, typeB) {
+        if (b != a && !(typeA == typeB && b < a))
+          n = addPair(pairs, n, max, a, b);
+      }
+    }
+    return n;
+  }
+
+  for (unsigned int c = 0; c < cells && n < max; c++) {
+    unsigned int begin = grid->cellStart[c], end = grid->cellStart[c + 1];
+
+    if (end - begin < 2)
+      continue;
+
+    for (unsigned int ea = begin; ea < end; ea++) {
+      int a = grid->entries[ea];
+      if (type[a] != typeA)
+        continue;
+
+      cellRange(grid, store, a, ra);
+      for (unsigned int eb = begin; eb < end; eb++) {
+        int b = grid->entries[eb];
+        if (type[b] != typeB || b == a || (typeA == typeB && b < a))
+          continue;
+
+        // Entities sharing several cells are paired in the first of them
+        cellRange(grid, store, b, rb);
+        unsigned int cx = (ra[0] > rb[0]) ? ra[0] : rb[0];
+        unsigned int cy = (ra[1] > rb[1]) ? ra[1] : rb[1];
+        if (cy * grid->cols + cx == c)
+          n = addPair(pairs, n, max, a, b);
+      }
+    }
+  }
+  return n;
+}
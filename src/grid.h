@@ -0,0 +1,30 @@
+// ----------------------------------- grid.h -------------------------------------
+// Works on an EntityStore, include entity.h first
+
+/* Uniform grid over the screen for the collision broadphase: every
+ * entity is listed in each cell its box touches over a step, so only
+ * entities that share a cell need a real test. Rebuilt every step */
+typedef struct {
+  unsigned int cellShift;  // cells are 1 << cellShift pixels square
+  unsigned int cols;
+  unsigned int rows;
+  int margin;  // boxes are grown by this much on each side
+
+  // Counting sort of the entries by cell: cell c lists
+  // entries[cellStart[c]] to entries[cellStart[c + 1] - 1]
+  unsigned int *cellStart;
+  int *entries;  // dense indices into the store
+  unsigned int capacity;
+  int complete;  // 0 if the entries did not fit: grid_pairs() tests all
+} Grid;
+
+/* Candidate pair: dense indices of an entity of each type asked for */
+typedef struct {
+  int a;
+  int b;
+} GridPair;
+
+/* Function Prototypes */
+int grid_init(Grid *grid, int width, int height, unsigned int cellShift, unsigned int capacity);
+int grid_build(Grid *grid, EntityStore *store, int margin);
+int grid_pairs(Grid *grid, EntityStore *store, unsigned int typeA, unsigned int typeB, GridPair *pairs, int max);
@@ -0,0 +1,87 @@
+// ----------------------------------- heap.c -------------------------------------
+#include "heap.h"
+
+#include "mmu.h"
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((unsigned long)(a) - 1))
+
+extern char _end[];  // link.ld: end of the kernel image, bss and stacks
+
+/* The heap runs from the end of the kernel to the end of the ARM's RAM.
+ * Memory taken from it is never given back: arenas are carved out once
+ * and recycle their own memory. Used from core 0 only */
+static unsigned long heapStart, heapTop, heapEnd;
+
+Arena frameArena;
+
+/**
+ * Set up the heap (after mmu_init(), which knows where the RAM ends) and
+ * the per-frame arena
+ */
+void heap_init() {
+  heapStart = ALIGN_UP((unsigned long)_end, HEAP_ALIGN);
+  heapTop = heapStart;
+  heapEnd = mmu_ramEnd();
+
+  arena_init(&frameArena, FRAME_ARENA_SIZE);
+}
+
+/**
+ * Take size bytes from the heap for good, HEAP_ALIGN aligned
+ * Returns 0 if the heap is exhausted
+ */
+void *heap_alloc(unsigned long size) {
+  unsigned long p = heapTop;
+
+  size = ALIGN_UP(size, HEAP_ALIGN);
+  if (size > heapEnd - heapTop)
+    return 0;
+
+  heapTop += size;
+  return (void *)p;
+}
+
+/**
+ * Bytes of the heap handed out so far and left (pointers may be 0)
+ */
+void heap_stats(unsigned long *used, unsigned long *free) {
+  if (used)
+    *used = heapTop - heapStart;
+  if (free)
+    *free = heapEnd - heapTop;
+}
+
+/**
+ * Give an arena size bytes of the heap. Returns 0 if they are not there
+ */
+int arena_init(Arena *arena, unsigned long size) {
+  arena->base = heap_alloc(size);
+  arena->size = arena->base ? size : 0;
+  arena->used = 0;
+  arena->peak = 0;
+  return arena->base != 0;
+}
+
+/**
+ * Take size bytes from an arena, HEAP_ALIGN aligned and not cleared
+ * Returns 0 if the arena is full
+ */
+void *arena_alloc(Arena *arena, unsigned long size) {
+  unsigned long offset = arena->used;
+
+  size = ALIGN_UP(size, HEAP_ALIGN);
+  if (size > arena->size - offset)
+    return 0;
+
+  arena->used += size;
+  if (arena->used > arena->peak)
+    arena->peak = arena->used;
+  return arena->base + offset;
+}
+
+/**
+ * Drop everything allocated from an arena
+ */
+void arena_reset(Arena *arena) {
+  arena->used = 0;
+}
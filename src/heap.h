@@ -0,0 +1,25 @@
+// ----------------------------------- heap.h -------------------------------------
+// Allocations are rounded up to this, enough for any type and for NEON
+#define HEAP_ALIGN 16
+
+// Scratch memory handed out during a frame and dropped all at once
+#define FRAME_ARENA_SIZE (256 * 1024)
+
+/* Bump allocator over a block of the heap, reset in one go */
+typedef struct {
+  unsigned char *base;
+  unsigned long size;
+  unsigned long used;
+  unsigned long peak;  // most ever used between two resets
+} Arena;
+
+extern Arena frameArena;
+
+/* Function Prototypes */
+void heap_init();
+void *heap_alloc(unsigned long size);
+void heap_stats(unsigned long *used, unsigned long *free);
+
+int arena_init(Arena *arena, unsigned long size);
+void *arena_alloc(Arena *arena, unsigned long size);
+void arena_reset(Arena *arena);
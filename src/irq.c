@@ -0,0 +1,59 @@
+// ----------------------------------- irq.c -------------------------------------
+#include "gpio.h"
+#include "dma.h"
+#include "frame.h"
+#include "irq.h"
+#include "mbox.h"
+#include "uart.h"
+
+extern char vectors[];  // boot.S
+
+/**
+ * Install the exception vectors and start taking interrupts on this core
+ */
+void irq_init() {
+  asm volatile("msr vbar_el1, %0; isb" ::"r"(vectors));
+  irq_enable();
+}
+
+void irq_enable() {
+  asm volatile("msr daifclr, #2" ::: "memory");
+}
+
+void irq_disable() {
+  asm volatile("msr daifset, #2" ::: "memory");
+}
+
+// Mask interrupts and return the previous state, for irq_restore()
+unsigned long irq_save() {
+  unsigned long flags;
+  asm volatile("mrs %0, daif; msr daifset, #2"
+               : "=r"(flags)
+               :
+               : "memory");
+  return flags;
+}
+
+void irq_restore(unsigned long flags) {
+  asm volatile("msr daif, %0" ::"r"(flags)
+               : "memory");
+}
+
+/**
+ * Called from the IRQ vector in boot.S (interrupts stay masked meanwhile)
+ */
+IRQ_HANDLER void irq_handler() {
+  unsigned int source = *CORE_IRQ_SOURCE(0);
+
+  if (source & CORE_IRQ_CNTP)
+    frame_tick();
+
+  if (source & CORE_IRQ_GPU) {
+    if (*IRQ_PENDING_1 & IRQ_AUX)
+      uart_irq();
+    if (*IRQ_PENDING_1 & IRQ_DMA_FULL)
+      dma_irq();
+    if (*IRQ_BASIC_PENDING & IRQ_BASIC_MAILBOX)
+      mbox_irq();
+  }
+}
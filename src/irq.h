@@ -0,0 +1,33 @@
+// ----------------------------------- irq.h -------------------------------------
+/* Interrupt controller (GPU peripherals, delivered to core 0) */
+#define IRQ_BASIC_PENDING ((volatile unsigned int *)(MMIO_BASE + 0x0000B200))
+#define IRQ_PENDING_1 ((volatile unsigned int *)(MMIO_BASE + 0x0000B204))
+#define IRQ_PENDING_2 ((volatile unsigned int *)(MMIO_BASE + 0x0000B208))
+#define ENABLE_IRQS_1 ((volatile unsigned int *)(MMIO_BASE + 0x0000B210))
+#define ENABLE_IRQS_2 ((volatile unsigned int *)(MMIO_BASE + 0x0000B214))
+#define DISABLE_IRQS_1 ((volatile unsigned int *)(MMIO_BASE + 0x0000B21C))
+#define ENABLE_BASIC_IRQS ((volatile unsigned int *)(MMIO_BASE + 0x0000B218))
+#define DISABLE_IRQS_2 ((volatile unsigned int *)(MMIO_BASE + 0x0000B220))
+
+#define IRQ_AUX (1 << 29)  // mini UART (in IRQ_PENDING_1 / ENABLE_IRQS_1)
+#define IRQ_DMA(ch) (1 << (16 + (ch)))  // DMA channels 0-12 (in IRQ_PENDING_1 / ENABLE_IRQS_1)
+#define IRQ_DMA_FULL (0x7F << 16)       // the full channels, see dma.c
+#define IRQ_BASIC_MAILBOX (1 << 1)  // ARM mailbox (in IRQ_BASIC_PENDING / ENABLE_BASIC_IRQS)
+
+/* ARM local interrupt sources of each core */
+#define CORE_IRQ_SOURCE(core) ((volatile unsigned int *)(0x40000060 + 4 * (core)))
+#define CORE_IRQ_CNTP (1 << 1)  // physical timer, see frame.c
+#define CORE_IRQ_GPU (1 << 8)
+
+// IRQ mask bit in the DAIF flags returned by irq_save()
+#define DAIF_IRQ (1 << 7)
+
+// Interrupt handlers must leave the FP/SIMD registers alone, the
+// exception entry in boot.S only saves the general purpose ones
+#define IRQ_HANDLER __attribute__((target("general-regs-only")))
+
+void irq_init();
+void irq_enable();
+void irq_disable();
+unsigned long irq_save();
+void irq_restore(unsigned long flags);
@@ -1,9 +1,18 @@
 // ----------------------------------- main.c -------------------------------------
 #include "main.h"
 
+#include "aabb.h"
+#include "frame.h"
 #include "framebf.h"
+#include "grid.h"
+#include "heap.h"
+#include "irq.h"
 #include "mbox.h"
 #include "menu.h"
+#include "mmu.h"
+#include "smp.h"
+#include "sprite.h"
+#include "tile.h"
 #include "uart.h"
 
 #define CHICKEN_COLS 6
@@ -11,20 +20,35 @@
 #define BIG_CHICKEN_BULLETS 3
 #define NUM_LIVES 3
 
-struct Object {
-  unsigned int type;
-  unsigned int x;
-  unsigned int y;
-  unsigned int width;
-  unsigned int height;
-  unsigned char alive;
-};
+// Entities a level can hold at the same time
+#define MAX_ENTITIES 4096
+
+// Collision grid: cells about the size of a sprite, room for every entity
+// in a few of them, and candidate pairs looked at per test
+#define GRID_CELL_SHIFT 6
+#define GRID_ENTRIES (MAX_ENTITIES * 4)
+#define MAX_PAIRS 256
+
+// Simulation rates, the pace the levels used to get from busy waits
+#define LEVEL_ONE_HZ 75
+#define LEVEL_TWO_HZ 180
+
+// Frames drawn per second at most, the simulation may step more often
+#define RENDER_HZ 60
+
+// Ship moves per second while a key is held, and ticks a lost ship stays
+// down (ticks per second / these)
+#define SHIP_MOVES_PER_SEC 10
+#define RESPAWN_DIV 2
 
+// Entity types
 enum {
   OBJ_NONE = 0,
   OBJ_CHICKEN = 1,
   OBJ_SHIP = 2,
-  OBJ_BULLET = 3
+  OBJ_BULLET = 3,  // the ship's
+  OBJ_CHICKEN_BULLET = 4,
+  OBJ_BIG_CHICKEN = 5
 };
 
 enum {
@@ -36,31 +60,61 @@ enum {
 
 int state = GAME_MENU;
 
-// Caveat: must be an even number
-// If using an odd number,
-// the middle chicken and the ship will be lined up,
-// then if the ship is hit by the middle bullet, UI freezes (?)
-unsigned int chickenColumns = CHICKEN_COLS;
-unsigned int bigChickenHealth = BIG_CHICKEN_HEALTH;
-unsigned int numChickens = 0;
-int chickenDirection = -1;
-
-int lives = NUM_LIVES;
-int points = 0;
-int velocity_x = 1;
-int velocity_y = 1;
-
-Object ship = {};
-Object bullet = {};
-
-// Level One enemies
-Object chickens[CHICKEN_COLS] = {};
-Object chickenBullets[CHICKEN_COLS] = {};
-Object* hitChicken;
-
-// Level Two enemy
-Object bigChicken = {};
-Object bigChickenBullets[BIG_CHICKEN_BULLETS] = {};
+// Everything the simulation advances. The step functions change it one
+// tick at a time, the render functions only read it
+typedef struct {
+  // Caveat: must be an even number
+  // If using an odd number,
+  // the middle chicken and the ship will be lined up,
+  // then if the ship is hit by the middle bullet, UI freezes (?)
+  unsigned int chickenColumns;
+  unsigned int bigChickenHealth;
+  int chickenDirection;
+  int formationX;  // x of the first chicken column, dead chickens included
+  int lives;
+  int points;
+  int velocity_x;
+  int velocity_y;
+  unsigned int respawnTicks;  // the ship is down, the game waits for it
+  unsigned int moveTicks;     // until the ship may move again
+  unsigned char input;        // last key pressed, used by the next step
+  unsigned int version;       // changes whenever something on screen does
+} GameState;
+
+GameState game = {
+    .chickenColumns = CHICKEN_COLS,
+    .bigChickenHealth = BIG_CHICKEN_HEALTH,
+    .chickenDirection = -1,
+    .lives = NUM_LIVES,
+    .velocity_x = 1,
+    .velocity_y = 1};
+
+// Every entity of the current level, emptied when a level starts
+EntityStore world;
+
+// Who is near whom, rebuilt every step before the collision tests, and
+// the boxes near the one being tested
+Grid grid;
+AabbBatch nearby;
+int nearbyEntity[MAX_PAIRS];  // dense index of each nearby box
+
+// Entities the game keeps track of, ENTITY_NONE (or stale) once removed
+Entity ship = ENTITY_NONE;
+Entity bullet = ENTITY_NONE;
+Entity bigChicken = ENTITY_NONE;
+
+// Level One chicken colors, by column
+static unsigned char chickenColors[CHICKEN_COLS] = {
+    0xff,
+    0xaa,
+    0x77,
+    0x55,
+    0x33,
+    0xee};
+
+// Pre-rendered sprites of every entity
+int spriteShip, spriteBullet, spriteChickenBullet, spriteBigChicken;
+int spriteChickens[CHICKEN_COLS];
 
 // UI variables to display endgame messages
 int zoom = 1;
@@ -70,8 +124,23 @@ int strheight = 8;
 unsigned char userChar;  // user input
 
 void main() {
-  uart_init();     // set up serial console
-  framebf_init();  // set up frame buffer
+  uart_init();       // set up serial console
+  framebf_init();    // set up frame buffer, query the board (MMU still off)
+  mmu_init();        // map memory, turn on the MMU and caches
+  heap_init();       // memory past the kernel, per-frame arena
+  irq_init();        // take interrupts (buffered UART input)
+  mbox_enableIrq();  // mailbox answers complete by interrupt
+  smp_init();        // wake up cores 1-3
+
+  // Entity columns, collision grid and pair boxes come from the heap
+  if (!entity_init(&world, MAX_ENTITIES) || !grid_init(&grid, WIDTH, HEIGHT, GRID_CELL_SHIFT, GRID_ENTRIES) ||
+      !aabb_init(&nearby, MAX_PAIRS)) {
+    uart_puts("Not enough memory for the game world\n");
+    uart_flush();  // main returning halts the core
+    return;
+  }
+
+  initSprites();     // pre-render entities
 
   // Enter game loop
   while (1) {
@@ -99,29 +168,25 @@ void main() {
 }
 
 void gameMenu() {
-  clearScreen(WIDTH, HEIGHT);
-
-  logo_init();  // set up logo
-  menu_init();  // set up menu
-  team_banner();
-
   int choice = GAME_LEVEL_ONE;
 
+  renderMenu(choice);
+  framebf_present();
+
   while (state == GAME_MENU) {
-    if ((userChar = getUart())) {
-      if (userChar == 'w' || userChar == 'W') {
-        drawString((WIDTH / 2) - 93, 350, "NEW GAME", 0x0b, 3);      // display <NEW GAME> with different color (blue)
-        drawString((WIDTH / 2) - 127, 400, "HOW TO PLAY", 0x0f, 3);  // display <HOW TO PLAY> with white color
-        choice = GAME_LEVEL_ONE;
-      } else if (userChar == 's' || userChar == 'S') {
-        drawString((WIDTH / 2) - 93, 350, "NEW GAME", 0x0f, 3);      // display <NEW GAME> with different color (blue)
-        drawString((WIDTH / 2) - 127, 400, "HOW TO PLAY", 0x0b, 3);  // display <HOW TO PLAY> with white color
-        choice = GAME_TUTORIAL;
-      } else if (userChar == '\n') {
-        // User press enter, confirm current choice and change state
-        state = choice;
-        break;
-      }
+    userChar = uart_getc();  // sleeps until a key arrives
+    if (userChar == 'w' || userChar == 'W') {
+      choice = GAME_LEVEL_ONE;
+      renderMenu(choice);
+      framebf_present();
+    } else if (userChar == 's' || userChar == 'S') {
+      choice = GAME_TUTORIAL;
+      renderMenu(choice);
+      framebf_present();
+    } else if (userChar == '\n') {
+      // User press enter, confirm current choice and change state
+      state = choice;
+      break;
     }
   }
 }
@@ -130,14 +195,14 @@ void gameTutorial() {
   clearScreen(WIDTH, HEIGHT);
 
   howtoplay_details();
+  framebf_present();
 
   while (state == GAME_TUTORIAL) {
-    if ((userChar = getUart())) {
-      // There is only one way to go, which is back to menu
-      if (userChar == 'm' || userChar == 'M') {
-        state = GAME_MENU;
-        break;
-      }
+    userChar = uart_getc();  // sleeps until a key arrives
+    // There is only one way to go, which is back to menu
+    if (userChar == 'm' || userChar == 'M') {
+      state = GAME_MENU;
+      break;
     }
   }
 }
@@ -146,132 +211,77 @@ void resetGame() {
   userChar = 0;
 
   // Reset all values
-  chickenColumns = CHICKEN_COLS;
-  bigChickenHealth = BIG_CHICKEN_HEALTH;
-  numChickens = 0;
-  chickenDirection = -1;
+  game.chickenColumns = CHICKEN_COLS;
+  game.bigChickenHealth = BIG_CHICKEN_HEALTH;
+  game.chickenDirection = -1;
+  game.formationX = 0;
+
+  resetEntities();
 
-  hitChicken = 0;
+  game.velocity_x = 1;
+  game.velocity_y = 1;
 
-  velocity_x = 1;
-  velocity_y = 1;
+  game.respawnTicks = 0;
+  game.moveTicks = 0;
+  game.input = 0;
 
   // Keep lives and points if going to level two
   if (state != GAME_LEVEL_TWO) {
-    lives = NUM_LIVES;
-    points = 0;
+    game.lives = NUM_LIVES;
+    game.points = 0;
   }
-
-  // Update UI
-  drawStars();
-  drawScoreboard(points, lives);
 }
 
 void levelOne() {
-  // Reset all values and UI
-  clearScreen(WIDTH, HEIGHT);
+  // Reset all values
   resetGame();
 
   // Initialize game entities
   initChickens();
-  for (int i = 0; i < CHICKEN_COLS; i++) {
-    initChickenBullet(i);
+  ENTITY_EACH(&world, i, OBJ_CHICKEN) {
+    initChickenBullet(world.handle[i]);
   }
   initShip();
-  initBullet();
+  initBullet(3 * game.velocity_y);
 
+  renderLevelOne();
   waitForKeyPress();
 
   // Start shooting!
-  while (lives > 0 && chickenColumns > 0) {
-    if ((userChar = getUart())) {
-      // Read char and move ship if necessary
-      parseShipMovement(userChar);
-    }
-
-    // Did the ship hit any of the chickens?
-    hitChicken = shipHitChicken(&bullet, velocity_x, velocity_y);
-    if (hitChicken) {
-      if (hitChicken->type == OBJ_CHICKEN) {
-        removeObject(hitChicken);
-        chickenColumns--;
-        points += 5;
-        drawScoreboard(points, lives);
-      }
-    }
-
-    // Check each chicken to see if it has hit the ship
-    for (int i = 0; i < CHICKEN_COLS; i++) {
-      if (chickenHitShip(&chickenBullets[i], velocity_x, velocity_y)) {
-        // Ship is hit...
-        lives--;
-
-        // Ceasefire!
-        for (int i = 0; i < CHICKEN_COLS; i++) {
-          removeObject(&chickenBullets[i]);
-          if (chickens[i].alive) {
-            initChickenBullet(i);
-          }
-        }
-
-        // Re-initialize ship
-        removeObject(&bullet);
-        removeObject(&ship);
-        wait_msec(500);  // Delay...
-        initShip();
-        initBullet();
-
-        // Update scores
-        drawScoreboard(points, lives);
-      } else {
-        // Chickens keep shooting down
-        moveObject(&chickenBullets[i], 0, velocity_y * 2);
-
-        // Chicken bullet is out of screen, draw a new one
-        if (chickenBullets[i].y + chickenBullets[i].height >= HEIGHT - MARGIN) {
-          removeObject(&chickenBullets[i]);
-          if (chickens[i].alive) {
-            initChickenBullet(i);
-          }
-        }
-      }
-    }
-
-    // Ship keeps shooting up
-    moveObject(&bullet, 0, -velocity_y * 3);
-
-    // Ship bullet is out of screen, draw a new one
-    if (bullet.y <= (MARGIN + 70)) {
-      removeObject(&bullet);
-      initBullet();
+  unsigned int drawnVersion = game.version;
+  frame_start(LEVEL_ONE_HZ, RENDER_HZ);
+  while (game.lives > 0 && game.chickenColumns > 0) {
+    unsigned int steps = frame_begin();  // sleeps until the next tick
+    arena_reset(&frameArena);            // last frame's scratch memory
+
+    // The last key that came in since the last frame, the next step
+    // moves the ship with it
+    while ((userChar = getUart()))
+      game.input = userChar;
+
+    // Catch the game up with the clock, one fixed step per tick
+    while (steps-- > 0 && game.lives > 0 && game.chickenColumns > 0)
+      stepLevelOne();
+
+    // Draw the latest state at the display rate, if anything changed
+    if (game.version != drawnVersion && frame_renderDue()) {
+      drawnVersion = game.version;
+      renderLevelOne();
+      framebf_present();
     }
-
-    // Change direction if chickens are moving out of bound
-    if (chickens[0].x < (MARGIN) ||
-        chickens[CHICKEN_COLS - 1].x > (WIDTH - MARGIN - 60)) {
-      chickenDirection *= -1;
-    }
-
-    // Move chickens left and right
-    for (int i = 0; i < CHICKEN_COLS; i++) {
-      moveObject(&chickens[i], chickenDirection * velocity_x, 0);
-      wait_msec(1800);  // Delay...
-    }
-
-    wait_msec(2200);  // Delay...
+    frame_end();
   }
+  frame_stop();
 
   // Clear screen
-  for (int i = 0; i < CHICKEN_COLS; i++) {
-    removeObject(&chickens[i]);
-    removeObject(&chickenBullets[i]);
-  }
-  removeObject(&bullet);
-  removeObject(&ship);
+  resetEntities();
+  renderLevelOne();
+  framebf_present();
 
   // Display endgame messages
   wait_msec(500);  // Delay...
-  if (chickenColumns == 0) {
+  renderLevelOne();
+  if (game.chickenColumns == 0) {
     zoom = WIDTH / 192;
     strwidth = 8 * 8 * zoom;
     strheight = 8 * zoom;
@@ -284,7 +294,7 @@ void levelOne() {
   }
 
   // Player has won
-  if (lives > 0 && chickenColumns == 0) {
+  if (game.lives > 0 && game.chickenColumns == 0) {
     zoom = 2;
     strwidth = 25 * 8 * zoom;
     drawString((WIDTH / 2) - (strwidth / 2), (HEIGHT / 2) + 35, "Press <N> to go Level Two", 0x0b, zoom);
@@ -298,134 +308,150 @@ void levelOne() {
   strwidth = 25 * 8 * zoom;
   strheight = 8 * zoom;
   drawString((WIDTH / 2) - (strwidth / 2), (HEIGHT / 2) + 35 + strheight + 5, "or <M> to go back to menu", 0x0b, zoom);
+  framebf_present();
 
   // Game has ended, wait for keypress
   while (1) {
-    if ((userChar = getUart())) {
-      if (userChar == 'n' || userChar == 'N') {
-        clearGameMessages();  // clear screen
-        state = GAME_LEVEL_TWO;
-        break;
-      } else if (userChar == 'r' || userChar == 'R') {
-        clearGameMessages();  // clear screen
-        state = GAME_LEVEL_ONE;
-        break;
-      } else if (userChar == 'm' || userChar == 'M') {
-        clearGameMessages();  // clear screen
-        state = GAME_MENU;
-        break;
-      }
+    userChar = uart_getc();  // sleeps until a key arrives
+    if (userChar == 'n' || userChar == 'N') {
+      state = GAME_LEVEL_TWO;
+      break;
+    } else if (userChar == 'r' || userChar == 'R') {
+      state = GAME_LEVEL_ONE;
+      break;
+    } else if (userChar == 'm' || userChar == 'M') {
+      state = GAME_MENU;
+      break;
     }
   };
 }
 
-void levelTwo() {
-  // Reset all values and UI
-  clearScreen(WIDTH, HEIGHT);
-  resetGame();
-
-  // Initialize game entities
-  initBigChicken();
-  initBigChickenBullets();
-  initShip();
-  initBullet();
+// Advance level one by one tick
+void stepLevelOne() {
+  // The ship is down: everything waits until it is back
+  if (game.respawnTicks > 0) {
+    if (--game.respawnTicks == 0) {
+      initShip();
+      initBullet(3 * game.velocity_y);
+    }
+    return;
+  }
 
-  // Draw initial chicken health
-  drawBigChickenHealth(BIG_CHICKEN_HEALTH);
+  stepShip(LEVEL_ONE_HZ);
 
-  // Wait for user input to start...
-  waitForKeyPress();
+  // All the collision tests follow the entities over this step's move,
+  // from where they are now, before any of them is removed
+  grid_build(&grid, &world, 0);
+  int hitChicken = shipHitChicken(bullet, OBJ_CHICKEN);
+  int hitShip = chickenHitShip();
 
-  // Play until ship or big chicken runs out of lives
-  while (lives > 0 && bigChickenHealth > 0) {
-    if ((userChar = getUart())) {
-      // Read char and move ship if necessary
-      parseShipMovement(userChar);
-    }
+  // Did the ship hit any of the chickens?
+  if (hitChicken >= 0) {
+    entity_remove(&world, hitChicken);
+    game.chickenColumns--;
+    game.points += 5;
+    game.version++;
+  }
 
-    // Did the ship hit the big chicken?
-    if (shipHitBigChicken(&bullet, velocity_x, velocity_y)) {
-      // Take that!
-      bigChickenHealth--;
-      points += 5;
+  // Did a chicken bullet hit the ship?
+  if (hitShip >= 0) {
+    // Ship is hit...
+    game.lives--;
 
-      removeObject(&bullet);
-      initBullet();
-      drawBigChickenHealth(bigChickenHealth);
-      drawScoreboard(points, lives);
+    // Ceasefire!
+    entity_removeType(&world, OBJ_CHICKEN_BULLET);
+    ENTITY_EACH(&world, c, OBJ_CHICKEN) {
+      initChickenBullet(world.handle[c]);
     }
 
-    // Check each big chicken bullet to see if it has hit the ship
-    for (int i = 0; i < BIG_CHICKEN_BULLETS; i++) {
-      if (chickenHitShip(&bigChickenBullets[i], velocity_x, velocity_y)) {
-        // Ship is hit...
-        lives--;
-
-        // Ceasefire!
-        for (int i = 0; i < BIG_CHICKEN_BULLETS; i++) {
-          removeObject(&bigChickenBullets[i]);
-        }
-        initBigChickenBullets();
-
-        // Re-initialize ship
-        removeObject(&bullet);
-        removeObject(&ship);
-        wait_msec(500);  // Delay...
-        initShip();
-        initBullet();
-
-        // Update scores
-        drawScoreboard(points, lives);
-      } else {
-        // Big chicken keeps shooting down
-        moveObject(&bigChickenBullets[i], 0, velocity_y);
-
-        // Chicken bullet is out of screen, draw a new one
-        if (bigChickenBullets[i].x + bigChickenBullets[i].width >= (WIDTH - MARGIN - 20)) {
-          removeObject(&bigChickenBullets[i]);
-        }
-
-        if (bigChickenBullets[i].y + bigChickenBullets[i].height >= (HEIGHT - MARGIN)) {
-          for (int i = 0; i < BIG_CHICKEN_BULLETS; i++) {
-            removeObject(&bigChickenBullets[i]);
-          }
-          initBigChickenBullets();
-        }
+    // Re-initialize ship, once it has been down for a while
+    removeEntity(&bullet);
+    removeEntity(&ship);
+    game.respawnTicks = LEVEL_ONE_HZ / RESPAWN_DIV;
+  } else {
+    ENTITY_EACH(&world, i, OBJ_CHICKEN_BULLET) {
+      // Chicken bullet is out of screen, its chicken (if alive) fires a new one
+      if (world.y[i] + world.height[i] >= HEIGHT - MARGIN) {
+        Entity chicken = world.owner[i];
+        entity_remove(&world, i);
+        initChickenBullet(chicken);
+        game.version++;
       }
-      wait_msec(1000);  // Delay...
     }
+  }
 
-    // Ship keeps shooting up
-    moveObject(&bullet, 0, -velocity_y);
+  // Ship bullet is out of screen, draw a new one
+  int b = entity_index(&world, bullet);
+  if (b >= 0 && world.y[b] <= (MARGIN + 70)) {
+    removeEntity(&bullet);
+    initBullet(3 * game.velocity_y);
+  }
 
-    // Ship bullet is out of screen, draw a new one
-    if (bullet.y <= (MARGIN + 70)) {
-      removeObject(&bullet);
-      initBullet();
+  // Change direction if chickens are moving out of bound (the formation
+  // keeps its width when the chickens at its ends are gone)
+  if (game.formationX < (MARGIN) ||
+      game.formationX + (CHICKEN_COLS - 1) * (VIRTWIDTH / CHICKEN_COLS) > (WIDTH - MARGIN - 60)) {
+    game.chickenDirection *= -1;
+    ENTITY_EACH(&world, i, OBJ_CHICKEN) {
+      world.vx[i] = game.chickenDirection * game.velocity_x;
     }
+  }
+  game.formationX += game.chickenDirection * game.velocity_x;
 
-    // Change direction if chickens are moving out of bound
-    if (bigChicken.x < (MARGIN + 150) ||
-        bigChicken.x > (WIDTH - MARGIN - 300)) {
-      chickenDirection *= -1;
-    }
+  // Chickens move left and right, bullets up and down
+  if (entity_move(&world))
+    game.version++;
+}
+
+void levelTwo() {
+  // Reset all values
+  resetGame();
+
+  // Initialize game entities
+  initBigChicken();
+  initBigChickenBullets();
+  initShip();
+  initBullet(game.velocity_y);
+
+  // Wait for user input to start...
+  renderLevelTwo();
+  waitForKeyPress();
 
-    // Move big chicken left and right
-    moveObject(&bigChicken, chickenDirection * velocity_x, 0);
-    wait_msec(2500);  // Delay...
+  // Play until ship or big chicken runs out of lives
+  unsigned int drawnVersion = game.version;
+  frame_start(LEVEL_TWO_HZ, RENDER_HZ);
+  while (game.lives > 0 && game.bigChickenHealth > 0) {
+    unsigned int steps = frame_begin();  // sleeps until the next tick
+    arena_reset(&frameArena);            // last frame's scratch memory
+
+    // The last key that came in since the last frame, the next step
+    // moves the ship with it
+    while ((userChar = getUart()))
+      game.input = userChar;
+
+    // Catch the game up with the clock, one fixed step per tick
+    while (steps-- > 0 && game.lives > 0 && game.bigChickenHealth > 0)
+      stepLevelTwo();
+
+    // Draw the latest state at the display rate, if anything changed
+    if (game.version != drawnVersion && frame_renderDue()) {
+      drawnVersion = game.version;
+      renderLevelTwo();
+      framebf_present();
+    }
+    frame_end();
   }
+  frame_stop();
 
   // Clear screen
-  removeObject(&bigChicken);
-  for (int i = 0; i < BIG_CHICKEN_BULLETS; i++) {
-    removeObject(&bigChickenBullets[i]);
-  }
-  removeObject(&bullet);
-  removeObject(&ship);
+  resetEntities();
+  renderLevelTwo();
+  framebf_present();
 
   // Display endgame messages
   wait_msec(500);  // Delay...
-  if (bigChickenHealth == 0) {
+  renderLevelTwo();
+  if (game.bigChickenHealth == 0) {
     zoom = WIDTH / 192;
     strwidth = 8 * 8 * zoom;
     strheight = 8 * zoom;
@@ -444,85 +470,403 @@ void levelTwo() {
   strwidth = 25 * 8 * zoom;
   strheight = 8 * zoom;
   drawString((WIDTH / 2) - (strwidth / 2), (HEIGHT / 2) + 35 + strheight + 5, "or <M> to go back to menu", 0x0b, zoom);
+  framebf_present();
 
   // Game has ended, wait for keypress
   while (1) {
-    if ((userChar = getUart())) {
-      if (userChar == 'r' || userChar == 'R') {
-        clearGameMessages();  // clear screen
-        state = GAME_LEVEL_ONE;
-        break;
-      } else if (userChar == 'm' || userChar == 'M') {
-        clearGameMessages();  // clear screen
-        state = GAME_MENU;
+    userChar = uart_getc();  // sleeps until a key arrives
+    if (userChar == 'r' || userChar == 'R') {
+      state = GAME_LEVEL_ONE;
+      break;
+    } else if (userChar == 'm' || userChar == 'M') {
+      state = GAME_MENU;
+      break;
+    }
+  };
+}
+
+// Advance level two by one tick
+void stepLevelTwo() {
+  // The ship is down: everything waits until it is back
+  if (game.respawnTicks > 0) {
+    if (--game.respawnTicks == 0) {
+      initShip();
+      initBullet(game.velocity_y);
+    }
+    return;
+  }
+
+  stepShip(LEVEL_TWO_HZ);
+
+  // All the collision tests follow the entities over this step's move,
+  // from where they are now, before any of them is removed
+  grid_build(&grid, &world, 0);
+  int hitChicken = shipHitChicken(bullet, OBJ_BIG_CHICKEN);
+  int hitShip = chickenHitShip();
+
+  // Did the ship hit the big chicken?
+  if (hitChicken >= 0) {
+    // Take that!
+    game.bigChickenHealth--;
+    game.points += 5;
+
+    removeEntity(&bullet);
+    initBullet(game.velocity_y);
+  }
+
+  // Did a big chicken bullet hit the ship?
+  if (hitShip >= 0) {
+    // Ship is hit...
+    game.lives--;
+
+    // Ceasefire!
+    entity_removeType(&world, OBJ_CHICKEN_BULLET);
+    initBigChickenBullets();
+
+    // Re-initialize ship, once it has been down for a while
+    removeEntity(&bullet);
+    removeEntity(&ship);
+    game.respawnTicks = LEVEL_TWO_HZ / RESPAWN_DIV;
+  } else {
+    ENTITY_EACH(&world, i, OBJ_CHICKEN_BULLET) {
+      // Chicken bullet is out of screen, draw a new one
+      if (world.x[i] + world.width[i] >= (WIDTH - MARGIN - 20)) {
+        entity_remove(&world, i);
+        game.version++;
+      } else if (world.y[i] + world.height[i] >= (HEIGHT - MARGIN)) {
+        entity_removeType(&world, OBJ_CHICKEN_BULLET);
+        initBigChickenBullets();
         break;
       }
     }
-  };
+  }
+
+  // All of them went off the side, fire again
+  if (entity_count(&world, OBJ_CHICKEN_BULLET) == 0)
+    initBigChickenBullets();
+
+  // Ship bullet is out of screen, draw a new one
+  int b = entity_index(&world, bullet);
+  if (b >= 0 && world.y[b] <= (MARGIN + 70)) {
+    removeEntity(&bullet);
+    initBullet(game.velocity_y);
+  }
+
+  // Change direction if the big chicken is moving out of bound
+  int c = entity_index(&world, bigChicken);
+  if (c >= 0 && (world.x[c] < (MARGIN + 150) ||
+                 world.x[c] > (WIDTH - MARGIN - 300))) {
+    game.chickenDirection *= -1;
+    world.vx[c] = game.chickenDirection * game.velocity_x;
+  }
+
+  // Big chicken moves left and right, bullets up and down
+  if (entity_move(&world))
+    game.version++;
 }
 
-// Delete an entity and mark dead
-void removeObject(Object* object) {
-  drawRect(object->x, object->y, object->x + object->width, object->y + object->height, 0, 1);
-  object->alive = 0;
+// Move the ship with the last key pressed, at most SHIP_MOVES_PER_SEC
+// times a second (hz: ticks per second)
+void stepShip(unsigned int hz) {
+  if (game.moveTicks > 0) {
+    game.moveTicks--;
+    return;
+  }
+
+  if (game.input) {
+    parseShipMovement(game.input);
+    game.input = 0;
+    game.moveTicks = hz / SHIP_MOVES_PER_SEC;
+  }
 }
 
-// Move an entity on the screen
-void moveObject(Object* object, int xoff, int yoff) {
-  moveRect(object->x, object->y, object->width, object->height, xoff, yoff, 0x00);
-  object->x = object->x + xoff;
-  object->y = object->y + yoff;
+// Empty the level: every entity is gone from the next frame
+void resetEntities() {
+  entity_clear(&world);
+  ship = bullet = bigChicken = ENTITY_NONE;
+  game.version++;
 }
 
-// Scan if the bullet has hit any of the chickens
-Object* shipHitChicken(Object* with, int xoff, int yoff) {
-  for (int i = 0; i < numChickens; i++) {
-    if (&chickens[i] != with && chickens[i].alive == 1) {
-      if (with->x + xoff > chickens[i].x + chickens[i].width || chickens[i].x > with->x + xoff + with->width) {
-        // with (Object) is too far left or right to collide
-      } else if (with->y + yoff > chickens[i].y + chickens[i].height || chickens[i].y > with->y + yoff + with->height) {
-        // with (Object) is too far up or down to collide
-      } else {
-        // Collision!
-        return &chickens[i];
-      }
-    }
+// Add an entity to the level, drawn with a sprite
+// Returns its dense index, -1 if the level is full
+static int spawn(unsigned int type, int x, int y, int width, int height, int sprite) {
+  int i = entity_index(&world, entity_add(&world, type, x, y, width, height));
+
+  if (i >= 0)
+    world.sprite[i] = sprite;
+  game.version++;
+  return i;
+}
+
+// Remove an entity we keep track of, it is no longer drawn from the next frame
+void removeEntity(Entity* e) {
+  entity_remove(&world, entity_index(&world, *e));
+  *e = ENTITY_NONE;
+  game.version++;
+}
+
+// Move an entity, it is drawn at the new position from the next frame
+void moveEntity(Entity e, int xoff, int yoff) {
+  int i = entity_index(&world, e);
+
+  if (i >= 0) {
+    world.x[i] += xoff;
+    world.y[i] += yoff;
+    game.version++;
   }
-  return 0;
 }
 
-// Scan if the bullet has hit the big chicken
-int shipHitBigChicken(Object* with, int xoff, int yoff) {
-  if (bigChicken.alive == 1) {
-    if (with->x + xoff > bigChicken.x + bigChicken.width || bigChicken.x > with->x + xoff + with->width) {
-      // with (Object) is too far left or right to collide
-    } else if (with->y + yoff > bigChicken.y + bigChicken.height || bigChicken.y > with->y + yoff + with->height) {
-      // with (Object) is too far up or down to collide
-    } else {
-      // Collision!
-      return 1;
-    }
+// Candidate pairs of two types from this step's grid, in frame scratch
+// memory. Returns how many
+static int candidatePairs(unsigned int typeA, unsigned int typeB, GridPair** pairs) {
+  *pairs = arena_alloc(&frameArena, MAX_PAIRS * sizeof(GridPair));
+  return *pairs ? grid_pairs(&grid, &world, typeA, typeB, *pairs, MAX_PAIRS) : 0;
+}
+
+// Box of an entity (dense index) where it is now
+static void entityBox(int i, AabbBox* box) {
+  box->x1 = world.x[i];
+  box->y1 = world.y[i];
+  box->x2 = world.x[i] + world.width[i];
+  box->y2 = world.y[i] + world.height[i];
+}
+
+// Box an entity covers over this step, moving by its velocity
+static void sweptBox(int i, AabbBox* box) {
+  entityBox(i, box);
+  if (world.vx[i] < 0)
+    box->x1 += world.vx[i];
+  else
+    box->x2 += world.vx[i];
+  if (world.vy[i] < 0)
+    box->y1 += world.vy[i];
+  else
+    box->y2 += world.vy[i];
+}
+
+// Add an entity (dense index) to the nearby boxes, with all it covers
+// over this step
+static void addNearby(int i) {
+  AabbBox box;
+
+  sweptBox(i, &box);
+  int k = aabb_add(&nearby, box.x1, box.y1, box.x2 - box.x1, box.y2 - box.y1);
+  if (k >= 0)
+    nearbyEntity[k] = i;
+}
+
+// When, from time on in this step, do the shapes of the sprites of q and
+// i first overlap? q is moved a pixel at a time relative
+// to i, which stays put. Returns the time (0 to AABB_TOI_ONE), -1 if never
+static int shapesMeet(int q, int i, int time) {
+  int dx = world.vx[q] - world.vx[i], dy = world.vy[q] - world.vy[i];
+  int adx = (dx < 0) ? -dx : dx, ady = (dy < 0) ? -dy : dy;
+  int steps = (adx > ady) ? adx : ady;
+
+  if (world.sprite[q] < 0 || world.sprite[i] < 0)
+    return time;  // no shape, the box is all there is
+  if (steps == 0)
+    return spriteCollide(world.sprite[q], world.x[q], world.y[q], world.sprite[i], world.x[i], world.y[i]) ? time : -1;
+
+  for (int s = steps * time / AABB_TOI_ONE; s <= steps; s++) {
+    if (spriteCollide(world.sprite[q], world.x[q] + dx * s / steps, world.y[q] + dy * s / steps,
+                      world.sprite[i], world.x[i], world.y[i]))
+      return (s * AABB_TOI_ONE) / steps;
   }
-  return 0;
+  return -1;
 }
 
-// Scan if one chicken bullet has hit the ship
-int chickenHitShip(Object* with, int xoff, int yoff) {
-  if (&ship != with && ship.alive == 1 && with->alive) {
-    if (with->x + xoff > ship.x + ship.width || ship.x > with->x + xoff + with->width) {
-      // with (Object) is too far left or right to collide
-    } else if (with->y + yoff > ship.y + ship.height || ship.y > with->y + yoff + with->height) {
-      // with (Object) is too far up or down to collide
-    } else {
-      // Collision!
-      return 1;
+// Which nearby entity does entity q run into first this step, all of them
+// moving by their velocity? The boxes they cover are tested all at once,
+// the ones that overlap are swept against q, and where the boxes meet the
+// sprites' shapes have the last word
+// Returns its dense index, -1 if none
+static int firstImpact(int q) {
+  unsigned long mask[AABB_MASK_WORDS(MAX_PAIRS)];
+  int first = -1, firstTime = AABB_TOI_ONE + 1;
+  AabbBox a, b;
+
+  sweptBox(q, &a);
+  if (!aabb_test(&nearby, a.x1, a.y1, a.x2, a.y2, mask))
+    return -1;
+
+  entityBox(q, &a);
+  for (unsigned int k = 0; k < nearby.count; k++) {
+    if (mask[k / AABB_MASK_BITS] & (1UL << (k % AABB_MASK_BITS))) {
+      int i = nearbyEntity[k];
+      entityBox(i, &b);
+
+      // Collision! (moving relative to each other)
+      int time = aabb_sweep(&a, world.vx[q] - world.vx[i], world.vy[q] - world.vy[i], &b);
+      if (time >= 0 && time < firstTime)
+        time = shapesMeet(q, i, time);
+      if (time >= 0 && time < firstTime) {
+        first = i;
+        firstTime = time;
+      }
     }
   }
-  return 0;
+  return first;
+}
+
+// Scan if the bullet hits any entity of a type (the chickens near it) this
+// step. Returns the dense index of the first one it hits, -1 if none
+int shipHitChicken(Entity with, unsigned int type) {
+  int b = entity_index(&world, with);
+  GridPair* pairs;
+
+  if (b < 0)
+    return -1;
+
+  int n = candidatePairs(world.type[b], type, &pairs);
+  aabb_clear(&nearby);
+  for (int k = 0; k < n; k++) {
+    if (pairs[k].a == b)
+      addNearby(pairs[k].b);
+  }
+
+  return firstImpact(b);
+}
+
+// Scan if a chicken bullet (one of those near the ship) hits the ship this
+// step. Returns the dense index of the bullet, -1 if none
+int chickenHitShip() {
+  int s = entity_index(&world, ship);
+  GridPair* pairs;
+
+  if (s < 0)
+    return -1;
+
+  int n = candidatePairs(OBJ_CHICKEN_BULLET, OBJ_SHIP, &pairs);
+  aabb_clear(&nearby);
+  for (int k = 0; k < n; k++)
+    addNearby(pairs[k].a);
+
+  return firstImpact(s);
 }
 
 // Initialize ship position
 void initShip() {
+  int baseWidth = 60;
+  int baseHeight = 20;
+  int headHeight = 15;
+
+  int i = spawn(OBJ_SHIP,
+                (WIDTH - baseWidth) / 2,
+                (HEIGHT - MARGIN - baseHeight - headHeight - 1),
+                baseWidth,
+                baseHeight + headHeight + 1,
+                spriteShip);
+  ship = (i >= 0) ? world.handle[i] : ENTITY_NONE;
+}
+
+// Initialize ship bullet position, above the ship and flying up at speed
+void initBullet(int speed) {
+  int bulletRadius = 5;
+  int s = entity_index(&world, ship);
+
+  bullet = ENTITY_NONE;
+  if (s < 0)
+    return;
+
+  int i = spawn(OBJ_BULLET,
+                world.x[s] + (world.width[s] / 2) - bulletRadius,
+                world.y[s] - (bulletRadius * 3),
+                bulletRadius * 2,
+                bulletRadius * 2,
+                spriteBullet);
+  if (i >= 0) {
+    world.vy[i] = -speed;
+    bullet = world.handle[i];
+  }
+}
+
+// Initialize chickens
+void initChickens() {
+  int baseWidth = 60;
+  int baseHeight = 30;
+  int headHeight = 17;
+
+  int xChicken = MARGIN + (VIRTWIDTH / CHICKEN_COLS / 2) - (baseWidth / 2);
+  int yChicken = MARGIN + baseHeight;
+
+  game.formationX = xChicken;
+  for (int c = 0; c < CHICKEN_COLS; c++) {
+    // Add to the level, moving with the formation
+    int i = spawn(OBJ_CHICKEN, xChicken, yChicken, baseWidth, baseHeight + headHeight, spriteChickens[c]);
+    if (i >= 0)
+      world.vx[i] = game.chickenDirection * game.velocity_x;
+
+    // Set cursor to next chicken
+    xChicken += (VIRTWIDTH / CHICKEN_COLS);
+  }
+}
+
+// Initialize a new chicken bullet under a chicken, if it is still alive
+void initChickenBullet(Entity chicken) {
+  int bulletRadius = 7;
+  int c = entity_index(&world, chicken);
+
+  if (c < 0)
+    return;
+
+  int i = spawn(OBJ_CHICKEN_BULLET,
+                world.x[c] + (world.width[c] / 2) - bulletRadius,
+                world.y[c] + world.height[c] + (bulletRadius * 2),
+                bulletRadius * 2,
+                bulletRadius * 2,
+                spriteChickenBullet);
+  if (i >= 0) {
+    world.vy[i] = game.velocity_y * 2;
+    world.owner[i] = chicken;
+  }
+}
+
+// Initialize big chicken
+void initBigChicken() {
+  int baseWidth = 140;
+  int baseHeight = 80;
+  int headHeight = 35;
+
+  int xChicken = (WIDTH / 2) - (baseWidth / 2);
+  int yChicken = MARGIN + (baseHeight / 2);
+
+  // Add the big chicken (the comb sticks out 10 pixels above the head)
+  int i = spawn(OBJ_BIG_CHICKEN, xChicken, yChicken - 10, baseWidth, baseHeight + headHeight + 20, spriteBigChicken);
+  bigChicken = ENTITY_NONE;
+  if (i >= 0) {
+    world.vx[i] = game.chickenDirection * game.velocity_x;
+    bigChicken = world.handle[i];
+  }
+}
+
+// Initialize many bullets for big chicken
+void initBigChickenBullets() {
+  int bulletRadius = 7;
+  int bulletDistance = 110;
+  int c = entity_index(&world, bigChicken);
+
+  if (c < 0)
+    return;
+
+  int xBullet = world.x[c] + (world.width[c] / 2) - (bulletDistance);
+  int yBullet = world.y[c] + world.height[c] + (bulletRadius * 2);
+
+  for (int b = 0; b < BIG_CHICKEN_BULLETS; b++) {
+    // Add to the level
+    int i = spawn(OBJ_CHICKEN_BULLET, xBullet - bulletRadius, yBullet - bulletRadius, bulletRadius * 2, bulletRadius * 2, spriteChickenBullet);
+    if (i >= 0) {
+      world.vy[i] = game.velocity_y;
+      world.owner[i] = bigChicken;
+    }
+
+    // Set cursor to next bullet
+    xBullet += bulletDistance;
+  }
+}
+
+// Draw the ship with its top left corner at x, y
+void drawShip(int x, int y) {
   int baseWidth = 60;
   int baseHeight = 20;
   int headWidth = 30;
@@ -531,152 +875,102 @@ void initShip() {
   int wedgeHeight = 7;
 
   // Draw base
-  drawRect((WIDTH - baseWidth) / 2,
-           (HEIGHT - MARGIN - baseHeight),
-           (WIDTH - baseWidth) / 2 + baseWidth,
-           (HEIGHT - MARGIN), 0x99,
+  drawRect(x,
+           y + headHeight + 1,
+           x + baseWidth,
+           y + headHeight + 1 + baseHeight, 0x99,
            1);
 
   // Draw head
-  drawRect((WIDTH - headWidth) / 2,
-           (HEIGHT - MARGIN - baseHeight - headHeight - 1),
-           (WIDTH - headWidth) / 2 + headWidth,
-           (HEIGHT - MARGIN - baseHeight - 1), 0xbb,
+  drawRect(x + (baseWidth - headWidth) / 2,
+           y,
+           x + (baseWidth - headWidth) / 2 + headWidth,
+           y + headHeight, 0xbb,
            1);
 
   // Draw wedge
-  drawRect((WIDTH - wedgeWidth) / 2,
-           (HEIGHT - MARGIN - baseHeight - headHeight - 1),
-           (WIDTH - wedgeWidth) / 2 + wedgeWidth,
-           (HEIGHT - MARGIN - baseHeight - 1 - (headHeight - wedgeHeight)), 0x00,
+  drawRect(x + (baseWidth - wedgeWidth) / 2,
+           y,
+           x + (baseWidth - wedgeWidth) / 2 + wedgeWidth,
+           y + wedgeHeight, 0x00,
            1);
-
-  ship.type = OBJ_SHIP;
-  ship.x = (WIDTH - baseWidth) / 2;
-  ship.y = (HEIGHT - MARGIN - baseHeight - headHeight - 1);
-  ship.width = baseWidth;
-  ship.height = baseHeight + headHeight + 1;
-  ship.alive = 1;
 }
 
-// Initialize ship bullet position
-void initBullet() {
-  int bulletRadius = 5;
+// Draw a round bullet filling a square box at x, y
+void drawBullet(int x, int y, int width, unsigned char attr) {
+  int bulletRadius = width / 2;
 
-  drawCircle(ship.x + (ship.width / 2), ship.y - (bulletRadius * 2), bulletRadius, 0xe0, 1);
-
-  bullet.type = OBJ_BULLET;
-  bullet.x = ship.x + (ship.width / 2) - bulletRadius;
-  bullet.y = ship.y - (bulletRadius * 3);
-  bullet.width = bulletRadius * 2;
-  bullet.height = bulletRadius * 2;
-  bullet.alive = 1;
+  drawCircle(x + bulletRadius, y + bulletRadius, bulletRadius, attr, 1);
 }
 
-// Initialize chickens
-void initChickens() {
+// Draw a small chicken with its top left corner at x, y
+void drawChicken(int x, int y, unsigned char color) {
   int baseWidth = 60;
   int baseHeight = 30;
   int headWidth = 25;
   int headHeight = 17;
 
-  static int chickenColors[CHICKEN_COLS] = {
-      0xff,
-      0xaa,
-      0x77,
-      0x55,
-      0x33,
-      0xee};
+  int xChicken = x;
+  int yChicken = y;
 
-  int xChicken = MARGIN + (VIRTWIDTH / CHICKEN_COLS / 2) - (baseWidth / 2);
-  int yChicken = MARGIN + baseHeight;
+  // Draw head
+  drawRect(xChicken + 10,
+           yChicken,
+           xChicken + 10 + headWidth,
+           yChicken + headHeight,
+           color,
+           1);
 
-  for (int i = 0; i < CHICKEN_COLS; i++) {
-    // Draw head
-    drawRect(xChicken + 10,
-             yChicken,
-             xChicken + 10 + headWidth,
-             yChicken + headHeight,
-             chickenColors[i],
-             1);
-
-    // Draw comb
-    drawRect(xChicken + 10, yChicken, xChicken + 10 + headWidth / 2, yChicken + 5, 0xcc, 1);
-
-    // Draw base
-    drawRect(xChicken,
-             yChicken + headHeight,
-             xChicken + baseWidth,
-             yChicken + headHeight + baseHeight,
-             chickenColors[i],
-             1);
-
-    drawRect(xChicken + 54,
-             yChicken + headHeight + 8,
-             xChicken + 60,
-             yChicken + headHeight + 12,
-             0x00,
-             1);
-
-    // Draw corner (left)
-    drawRect(xChicken,
-             yChicken + headHeight + baseHeight - 5,
-             xChicken + 5,
-             yChicken + headHeight + baseHeight,
-             0x00,
-             1);
-
-    // Draw corner (right)
-    drawRect(xChicken + baseWidth - 5,
-             yChicken + headHeight + baseHeight - 5,
-             xChicken + baseWidth,
-             yChicken + headHeight + baseHeight,
-             0x00,
-             1);
-
-    // Draw eye
-    drawRect(xChicken + 17, yChicken + 10, xChicken + 22, yChicken + 15, 0x00, 1);
-
-    // Draw beak
-    drawRect(xChicken + 4, yChicken + 11, xChicken + 12, yChicken + 16, 0x66, 1);
-
-    // Add to chicken array
-    chickens[numChickens].type = OBJ_CHICKEN;
-    chickens[numChickens].x = xChicken;
-    chickens[numChickens].y = yChicken;
-    chickens[numChickens].width = baseWidth;
-    chickens[numChickens].height = baseHeight + headHeight;
-    chickens[numChickens].alive = 1;
-    numChickens++;
+  // Draw comb
+  drawRect(xChicken + 10, yChicken, xChicken + 10 + headWidth / 2, yChicken + 5, 0xcc, 1);
 
-    // Set cursor to next chicken
-    xChicken += (VIRTWIDTH / CHICKEN_COLS);
-  }
-}
+  // Draw base
+  drawRect(xChicken,
+           yChicken + headHeight,
+           xChicken + baseWidth,
+           yChicken + headHeight + baseHeight,
+           color,
+           1);
 
-// Draw a new chicken bullet for each chicken (by index)
-void initChickenBullet(int i) {
-  int bulletRadius = 7;
+  drawRect(xChicken + 54,
+           yChicken + headHeight + 8,
+           xChicken + 60,
+           yChicken + headHeight + 12,
+           0x00,
+           1);
 
-  drawCircle(chickens[i].x + (chickens[i].width / 2), chickens[i].y + chickens[i].height + (bulletRadius * 3), bulletRadius, 0xc0, 1);
+  // Draw corner (left)
+  drawRect(xChicken,
+           yChicken + headHeight + baseHeight - 5,
+           xChicken + 5,
+           yChicken + headHeight + baseHeight,
+           0x00,
+           1);
 
-  chickenBullets[i].type = OBJ_BULLET;
-  chickenBullets[i].x = chickens[i].x + (chickens[i].width / 2) - bulletRadius;
-  chickenBullets[i].y = chickens[i].y + chickens[i].height + (bulletRadius * 2);
-  chickenBullets[i].width = bulletRadius * 2;
-  chickenBullets[i].height = bulletRadius * 2;
-  chickenBullets[i].alive = 1;
+  // Draw corner (right)
+  drawRect(xChicken + baseWidth - 5,
+           yChicken + headHeight + baseHeight - 5,
+           xChicken + baseWidth,
+           yChicken + headHeight + baseHeight,
+           0x00,
+           1);
+
+  // Draw eye
+  drawRect(xChicken + 17, yChicken + 10, xChicken + 22, yChicken + 15, 0x00, 1);
+
+  // Draw beak
+  drawRect(xChicken + 4, yChicken + 11, xChicken + 12, yChicken + 16, 0x66, 1);
 }
 
-// Initialize big chicken
-void initBigChicken() {
+// Draw the big chicken with its top left corner (the comb's) at x, y
+void drawBigChicken(int x, int y) {
   int baseWidth = 140;
   int baseHeight = 80;
   int headWidth = 50;
   int headHeight = 35;
 
-  int xChicken = (WIDTH / 2) - (baseWidth / 2);
-  int yChicken = MARGIN + (baseHeight / 2);
+  int xChicken = x;
+  int yChicken = y + 10;
 
   // Draw head
   drawRect(xChicken + 30,
@@ -728,37 +1022,111 @@ void initBigChicken() {
 
   // Draw beak
   drawRect(xChicken + 10, yChicken + headHeight - 20, xChicken + 35, yChicken + headHeight - 10, 0x66, 1);
+}
 
-  // Set big chicken object
-  bigChicken.type = OBJ_CHICKEN;
-  bigChicken.x = xChicken;
-  bigChicken.y = yChicken - 10;
-  bigChicken.width = baseWidth;
-  bigChicken.height = baseHeight + headHeight + 20;
-  bigChicken.alive = 1;
+// Record one entity (by dense index) into a new sprite, drawn at the
+// corner of its cell
+// Entities are drawn with inclusive rectangles, one pixel more than their box
+static int beginEntitySprite(int i) {
+  return spriteBegin(world.width[i] + 1, world.height[i] + 1);
 }
 
-// Draw many bullets for big chicken
-void initBigChickenBullets() {
-  int bulletRadius = 7;
-  int bulletDistance = 110;
-  int xBullet = bigChicken.x + (bigChicken.width / 2) - (bulletDistance);
-  int yBullet = bigChicken.y + bigChicken.height + (bulletRadius * 2);
+// Pre-render every entity into the sprite atlas, once at boot
+void initSprites() {
+  int i;
+
+  // The init functions give us the size of each entity
+  resetEntities();
+  initShip();
+  initBullet(0);
+  initChickens();
+  initChickenBullet(world.handle[entity_find(&world, (int)world.count - 1, OBJ_CHICKEN)]);
+  initBigChicken();
 
-  for (int i = 0; i < BIG_CHICKEN_BULLETS; i++) {
-    drawCircle(xBullet, yBullet, bulletRadius, 0xc0, 1);
+  i = entity_index(&world, ship);
+  spriteShip = beginEntitySprite(i);
+  drawShip(0, 0);
+  spriteEnd(spriteShip);
+
+  i = entity_index(&world, bullet);
+  spriteBullet = beginEntitySprite(i);
+  drawBullet(0, 0, world.width[i], 0xe0);
+  spriteEnd(spriteBullet);
+
+  // All the chickens have the same size, one sprite per color
+  i = entity_find(&world, (int)world.count - 1, OBJ_CHICKEN);
+  for (int c = 0; c < CHICKEN_COLS; c++) {
+    spriteChickens[c] = beginEntitySprite(i);
+    drawChicken(0, 0, chickenColors[c]);
+    spriteEnd(spriteChickens[c]);
+  }
 
-    // Add to bullet array
-    bigChickenBullets[i].type = OBJ_BULLET;
-    bigChickenBullets[i].x = xBullet - bulletRadius;
-    bigChickenBullets[i].y = yBullet - bulletRadius;
-    bigChickenBullets[i].width = bulletRadius * 2;
-    bigChickenBullets[i].height = bulletRadius * 2;
-    bigChickenBullets[i].alive = 1;
+  i = entity_find(&world, (int)world.count - 1, OBJ_CHICKEN_BULLET);
+  spriteChickenBullet = beginEntitySprite(i);
+  drawBullet(0, 0, world.width[i], 0xc0);
+  spriteEnd(spriteChickenBullet);
 
-    // Set cursor to next bullet
-    xBullet += bulletDistance;
+  i = entity_index(&world, bigChicken);
+  spriteBigChicken = beginEntitySprite(i);
+  drawBigChicken(0, 0);
+  spriteEnd(spriteBigChicken);
+
+  resetEntities();
+}
+
+// Draw every entity of a type at its position
+static void renderEntities(unsigned int type) {
+  ENTITY_EACH(&world, i, type) {
+    blitSprite(world.sprite[i], world.x[i], world.y[i]);
+  }
+}
+
+// Draw the whole menu screen into the back buffer
+void renderMenu(int choice) {
+  tile_begin();  // binned, drawn on every core by tile_end()
+  clearScreen(WIDTH, HEIGHT);
+
+  logo_init();  // set up logo
+  menu_init();  // set up menu
+  team_banner();
+
+  if (choice == GAME_TUTORIAL) {
+    drawString((WIDTH / 2) - 93, 350, "NEW GAME", 0x0f, 3);      // display <NEW GAME> with white color
+    drawString((WIDTH / 2) - 127, 400, "HOW TO PLAY", 0x0b, 3);  // display <HOW TO PLAY> with different color (blue)
   }
+
+  tile_end();
+}
+
+// Draw a whole level one frame into the back buffer
+void renderLevelOne() {
+  tile_begin();  // binned, drawn on every core by tile_end()
+  clearScreen(WIDTH, HEIGHT);
+  drawStars();
+  drawScoreboard(game.points, game.lives);
+
+  renderEntities(OBJ_CHICKEN);
+  renderEntities(OBJ_CHICKEN_BULLET);
+  renderEntities(OBJ_SHIP);
+  renderEntities(OBJ_BULLET);
+
+  tile_end();
+}
+
+// Draw a whole level two frame into the back buffer
+void renderLevelTwo() {
+  tile_begin();  // binned, drawn on every core by tile_end()
+  clearScreen(WIDTH, HEIGHT);
+  drawStars();
+  drawScoreboard(game.points, game.lives);
+  drawBigChickenHealth(game.bigChickenHealth);
+
+  renderEntities(OBJ_BIG_CHICKEN);
+  renderEntities(OBJ_CHICKEN_BULLET);
+  renderEntities(OBJ_SHIP);
+  renderEntities(OBJ_BULLET);
+
+  tile_end();
 }
 
 // Draw the scoreboard
@@ -775,8 +1143,13 @@ void drawScoreboard(int score, int lives) {
 
 // Draw remaining health of big chicken
 void drawBigChickenHealth(int health) {
+  int c = entity_index(&world, bigChicken);
   int xStart = 580;
-  int yStart = bigChicken.y - 15;
+
+  if (c < 0)
+    return;
+
+  int yStart = world.y[c] - 15;
 
   // Clear old health
   drawRect(xStart, yStart, xStart + 200, yStart + 10, 0x00, 1);
@@ -813,46 +1186,42 @@ void drawStars() {
   }
 }
 
-// Clear messages in the middle of the screen
-void clearGameMessages() {
-  int xStart = MARGIN + 20;
-  int xEnd = xStart + WIDTH - (MARGIN * 2) - 100;
-  int yStart = HEIGHT / 2 - 50;
-  int yEnd = HEIGHT / 2 + 100;
-  drawRect(xStart, yStart, xEnd, yEnd, 0x00, 1);
-}
-
 // Read user input and move ship
 void parseShipMovement(char c) {
+  int s = entity_index(&world, ship);
+  if (s < 0)
+    return;
+
+  int x = world.x[s], y = world.y[s];
+  int width = world.width[s], height = world.height[s];
+
   // Move ship left
   if (c == 'a' || c == 'A') {
-    if (ship.x >= MARGIN + (ship.width / 3) + 20) {
-      moveObject(&ship, -(ship.width / 3), 0);
+    if (x >= MARGIN + (width / 3) + 20) {
+      moveEntity(ship, -(width / 3), 0);
     }
   }
 
   // Move ship right
   else if (c == 'd' || c == 'D') {
-    if (ship.x + ship.width + (ship.width / 3) <= WIDTH - MARGIN - 20) {
-      moveObject(&ship, ship.width / 3, 0);
+    if (x + width + (width / 3) <= WIDTH - MARGIN - 20) {
+      moveEntity(ship, width / 3, 0);
     }
   }
 
   // Move ship up
   else if (c == 'w' || c == 'W') {
-    if (ship.y >= MARGIN + (ship.height * 4)) {
-      moveObject(&ship, 0, -(ship.height / 3));
+    if (y >= MARGIN + (height * 4)) {
+      moveEntity(ship, 0, -(height / 3));
     }
   }
 
   // Move ship down
   else if (c == 's' || c == 'S') {
-    if (ship.y + ship.height + (ship.height / 3) <= HEIGHT - MARGIN) {
-      moveObject(&ship, 0, ship.height / 3);
+    if (y + height + (height / 3) <= HEIGHT - MARGIN) {
+      moveEntity(ship, 0, height / 3);
     }
   }
-
-  wait_msec(100);  // Delay...
 }
 
 void waitForKeyPress() {
@@ -860,8 +1229,7 @@ void waitForKeyPress() {
   zoom = 2;
   strwidth = 25 * 8 * zoom;
   drawString((WIDTH / 2) - (strwidth / 2), (HEIGHT / 2) + 35, "Press any key to start...", 0x0b, zoom);
+  framebf_present();
 
-  while (!getUart())
-    ;
-  clearGameMessages();
+  uart_getc();  // sleeps until a key arrives
 }
\ No newline at end of file
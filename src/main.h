@@ -1,5 +1,5 @@
 // ----------------------------------- main.h -------------------------------------
-typedef struct Object Object;
+#include "entity.h"
 
 // Game functions
 void gameMenu();
@@ -7,29 +7,43 @@ void gameTutorial();
 void resetGame();
 void levelOne();
 void levelTwo();
+void stepLevelOne();
+void stepLevelTwo();
+void stepShip(unsigned int hz);
 
-// Generic move/delete object functions
-void removeObject(Object *object);
-void moveObject(Object *object, int xoff, int yoff);
+// Generic move/delete entity functions (state only, drawn by the render functions)
+void resetEntities();
+void removeEntity(Entity *e);
+void moveEntity(Entity e, int xoff, int yoff);
 
 // Collision detector
-Object *shipHitChicken(Object *with, int xoff, int yoff);
-int shipHitBigChicken(Object *with, int xoff, int yoff);
-int chickenHitShip(Object *with, int xoff, int yoff);
+int shipHitChicken(Entity with, unsigned int type);
+int chickenHitShip();
 
 // Entity initialization
 void initShip();
-void initBullet();
+void initBullet(int speed);
 void initChickens();
-void initChickenBullet(int i);
+void initChickenBullet(Entity chicken);
 void initBigChicken();
 void initBigChickenBullets();
 
+// Entity drawing (used once to fill the sprite atlas)
+void initSprites();
+void drawShip(int x, int y);
+void drawBullet(int x, int y, int width, unsigned char attr);
+void drawChicken(int x, int y, unsigned char color);
+void drawBigChicken(int x, int y);
+
+// Whole-frame rendering into the back buffer
+void renderMenu(int choice);
+void renderLevelOne();
+void renderLevelTwo();
+
 // UI functions
 void drawScoreboard(int score, int lives);
 void drawBigChickenHealth(int health);
 void drawStars();
-void clearGameMessages();
 
 // Utilities
 void parseShipMovement(char c);
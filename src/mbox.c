@@ -2,6 +2,8 @@
 #include "mbox.h"
 
 #include "gpio.h"
+#include "irq.h"
+#include "mmu.h"
 #include "uart.h"
 
 /* Mailbox Data Buffer (each element is 32-bit)*/
@@ -16,29 +18,42 @@
  * We must ensure that our our buffer is located at a 16 byte aligned address, * so only the high 28 bits contain the address
  * (last 4 bits is ZERO due to 16 byte alignment)
  *
+ * With the data cache on, the buffer is also aligned and sized to whole
+ * 64-byte cache lines, so it can be invalidated without touching
+ * neighbouring variables
  */
-volatile unsigned int __attribute__((aligned(16))) mBuf[36];
+volatile unsigned int __attribute__((aligned(64))) mBuf[MBOX_BUF_WORDS];
 
-/**
- * Read from the mailbox
- */
-uint32_t mailbox_read(unsigned char channel) {
-  // Receiving message is buffer_addr & channel number
-  uint32_t res;
+/* Message buffers for asynchronous calls, same size and alignment as mBuf */
+volatile unsigned int __attribute__((aligned(64))) mboxPool[MBOX_POOL_SIZE][MBOX_BUF_WORDS];
 
-  // Make sure that the message is from the right channel
-  do {
-    // Make sure there is mail to receive
-    do {
-      asm volatile("nop");
-    } while (*MBOX0_STATUS & MBOX_EMPTY);
+/* State of every pool buffer, plus one more slot for mbox_call().
+ * Answers are matched to their message by buffer address, so they can be
+ * collected in any order, by whoever reads the mailbox first */
+enum {
+  SLOT_FREE,
+  SLOT_TAKEN,  // handed out by mbox_get(), being filled
+  SLOT_SENT,   // waiting for the answer
+  SLOT_DONE    // answered, not released yet
+};
 
-    // Get the message
-    res = *MBOX0_READ;
-  } while ((res & 0xF) != channel);
+#define SYNC_SLOT MBOX_POOL_SIZE
 
-  return res;
-}
+static volatile unsigned char slotState[MBOX_POOL_SIZE + 1];
+static volatile unsigned int *slotBuf[MBOX_POOL_SIZE + 1];
+static unsigned int slotMsg[MBOX_POOL_SIZE + 1];
+static int mboxIrq = 0;
+
+SysInfo sysInfo;
+
+// Where the system queries were added by mbox_addSysInfo()
+static volatile MboxWord *qRevision, *qDmaChannels;
+static volatile MboxRange *qArmMem;
+static volatile MboxIdValue *qArmClock, *qCoreClock, *qTemperature;
+
+// Value buffer handed out for tags that do not fit in their message, after
+// a tag header word that never reads as answered
+static volatile unsigned int overflowTag[1 + MBOX_BUF_WORDS];
 
 /**
  * Write to the mailbox
@@ -54,7 +69,130 @@ void mailbox_send(uint32_t msg, unsigned char channel) {
 }
 
 /**
- * Make a mailbox call. Returns 0 on failure, non-zero on success */
+ * Take every answer waiting in the mailbox and mark its message done
+ * (answers to nothing we sent are dropped)
+ */
+IRQ_HANDLER static void collect() {
+  while (!(*MBOX0_STATUS & MBOX_EMPTY)) {
+    unsigned int res = *MBOX0_READ;
+
+    for (int i = 0; i <= SYNC_SLOT; i++) {
+      if (slotState[i] == SLOT_SENT && slotMsg[i] == res) {
+        slotState[i] = SLOT_DONE;
+        break;
+      }
+    }
+  }
+}
+
+/**
+ * Mailbox interrupt: collect answers as soon as they come in
+ */
+IRQ_HANDLER void mbox_irq() {
+  collect();
+}
+
+/**
+ * Complete calls from the mailbox interrupt, mbox_wait() then sleeps
+ * instead of polling. Needs irq_init()
+ */
+void mbox_enableIrq() {
+  *MBOX0_CONFIG = MBOX_CONFIG_IRQ;
+  *ENABLE_BASIC_IRQS = IRQ_BASIC_MAILBOX;
+  mboxIrq = 1;
+}
+
+// Clean a message out to RAM and post it, the slot waits for its answer
+static void post(int slot, volatile unsigned int *buf, unsigned char channel) {
+  slotBuf[slot] = buf;
+  slotMsg[slot] = (ADDR(buf) & ~0xF) | (channel & 0xF);
+  slotState[slot] = SLOT_SENT;
+
+  // The GPU reads and writes RAM directly, past our data cache
+  dcache_clean(buf, MBOX_BUF_WORDS * 4);
+  mailbox_send(slotMsg[slot], channel);
+}
+
+// Wait for a slot's answer and check its response code
+static int finish(int slot) {
+  while (1) {
+    unsigned long flags = irq_save();
+    collect();
+    if (slotState[slot] == SLOT_DONE) {
+      irq_restore(flags);
+      break;
+    }
+    if (mboxIrq)
+      asm volatile("wfi");  // the answer's interrupt wakes us
+    irq_restore(flags);
+  }
+
+  // Drop whatever the CPU may have cached while the GPU was writing
+  dcache_invalidate(slotBuf[slot], MBOX_BUF_WORDS * 4);
+  return slotBuf[slot][1] == MBOX_RESPONSE;
+}
+
+/**
+ * Get a free message buffer (MBOX_BUF_WORDS words) for mbox_submit()
+ * Returns 0 if all of them are in use
+ */
+volatile unsigned int *mbox_get() {
+  for (int i = 0; i < MBOX_POOL_SIZE; i++) {
+    if (slotState[i] == SLOT_FREE) {
+      slotState[i] = SLOT_TAKEN;
+      return mboxPool[i];
+    }
+  }
+  return 0;
+}
+
+/**
+ * Send a message filled in a buffer from mbox_get(), without waiting
+ * Returns a handle for mbox_poll()/mbox_wait()/mbox_release(), or -1
+ */
+int mbox_submit(volatile unsigned int *buf, unsigned char channel) {
+  for (int i = 0; i < MBOX_POOL_SIZE; i++) {
+    if (buf == mboxPool[i] && slotState[i] == SLOT_TAKEN) {
+      post(i, buf, channel);
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Has the answer to a submitted message arrived? Does not wait
+ */
+int mbox_poll(int handle) {
+  unsigned long flags = irq_save();
+  collect();
+  irq_restore(flags);
+
+  return slotState[handle] == SLOT_DONE;
+}
+
+/**
+ * Wait for the answer to a submitted message, it can then be read from
+ * the buffer. Returns 0 on failure, non-zero on success
+ */
+int mbox_wait(int handle) {
+  return finish(handle);
+}
+
+/**
+ * Give a buffer back to the pool once its answer has been read
+ * (a message still in flight is waited for first)
+ */
+void mbox_release(int handle) {
+  if (slotState[handle] == SLOT_SENT)
+    finish(handle);
+  slotState[handle] = SLOT_FREE;
+}
+
+/**
+ * Make a mailbox call and wait for the answer. The buffer (usually mBuf)
+ * must be aligned like mBuf and MBOX_BUF_WORDS words long
+ * Returns 0 on failure, non-zero on success */
 int mbox_call(unsigned int buffer_addr, unsigned char channel) {
   // Check Buffer Address
 
@@ -62,17 +200,119 @@ int mbox_call(unsigned int buffer_addr, unsigned char channel) {
   // uart_hex(buffer_addr);
   // uart_sendc('\n');
 
-  // Prepare Data (address of Message Buffer)
-  unsigned int msg = (buffer_addr & ~0xF) | (channel & 0xF);
-  mailbox_send(msg, channel);
-
-  /* now wait for the response */
-  /* is it a response to our message (same address)? */
-  if (msg == mailbox_read(channel)) {
-    /* is it a valid successful response (Response Code) ? */
-    if (mBuf[1] == MBOX_RESPONSE)
-      // uart_puts("Got successful response \n");
-      return (mBuf[1] == MBOX_RESPONSE);
+  post(SYNC_SLOT, (volatile unsigned int *)(unsigned long)buffer_addr, channel);
+
+  /* now wait for the response, and check it is a valid successful one */
+  int ok = finish(SYNC_SLOT);
+  slotState[SYNC_SLOT] = SLOT_FREE;
+  return ok;
+}
+
+/**
+ * Start a property message in buf (mBuf, or a buffer from mbox_get())
+ */
+void mbox_start(MboxMsg *msg, volatile unsigned int *buf) {
+  msg->buf = buf;
+  msg->words = 2;
+  msg->overflow = 0;
+  buf[1] = MBOX_REQUEST;
+}
+
+/**
+ * Append a tag with a value buffer of size bytes, cleared, and return the
+ * value buffer. Use MBOX_ADD() for tags with a declared layout
+ * A tag that does not fit gets a scratch buffer and fails the message
+ */
+volatile void *mbox_addTag(MboxMsg *msg, unsigned int tag, unsigned int size) {
+  unsigned int valueWords = (size + 3) / 4;
+  volatile unsigned int *t;
+
+  // Room for the tag header, its value buffer and the end tag
+  if (msg->words + 3 + valueWords + 1 > MBOX_BUF_WORDS) {
+    msg->overflow = 1;
+    for (unsigned int i = 0; i < valueWords && i < MBOX_BUF_WORDS; i++)
+      overflowTag[1 + i] = 0;
+    return overflowTag + 1;
   }
-  return 0;
-}
\ No newline at end of file
+
+  t = msg->buf + msg->words;
+  t[0] = tag;
+  t[1] = valueWords * 4;  // Value buffer size in bytes
+  t[2] = MBOX_REQUEST;    // Becomes MBOX_RESPONSE | answer length
+  for (unsigned int i = 0; i < valueWords; i++)
+    t[3 + i] = 0;
+
+  msg->words += 3 + valueWords;
+  return t + 3;
+}
+
+/**
+ * End the message and fill in its length, ready for mbox_call() or
+ * mbox_submit(). Returns 0 if a tag did not fit
+ */
+int mbox_finish(MboxMsg *msg) {
+  if (msg->overflow)
+    return 0;
+
+  msg->buf[msg->words] = MBOX_TAG_LAST;
+  msg->buf[0] = (msg->words + 1) * 4;  // Length of message in bytes
+  return 1;
+}
+
+/**
+ * Finish the message and make the call on the property channel
+ * Returns 0 on failure, non-zero on success
+ */
+int mbox_send(MboxMsg *msg) {
+  return mbox_finish(msg) && mbox_call(ADDR(msg->buf), MBOX_CH_PROP);
+}
+
+/**
+ * Did the GPU answer the tag owning this value buffer?
+ */
+int mbox_answered(volatile void *value) {
+  return (((volatile unsigned int *)value)[-1] & MBOX_RESPONSE) != 0;
+}
+
+/**
+ * Add the board revision, ARM memory, clock rates, temperature and DMA
+ * channel queries to a message, so they ride along with it (the boot
+ * message)
+ */
+void mbox_addSysInfo(MboxMsg *msg) {
+  qRevision = MBOX_ADD(msg, GETREVISION);
+  qArmMem = MBOX_ADD(msg, GETARMMEM);
+  qArmClock = MBOX_ADD(msg, GETCLKRATE);
+  qArmClock->id = MBOX_CLK_ARM;
+  qCoreClock = MBOX_ADD(msg, GETCLKRATE);
+  qCoreClock->id = MBOX_CLK_CORE;
+  qTemperature = MBOX_ADD(msg, GETTEMPERATURE);
+  qTemperature->id = 0;
+  qDmaChannels = MBOX_ADD(msg, GETDMACHANNELS);
+}
+
+/**
+ * Read the answers to mbox_addSysInfo()'s queries into sysInfo, once the
+ * message was sent. Queries left unanswered read as 0
+ */
+void mbox_readSysInfo() {
+  if (!qRevision)
+    return;
+
+  if (mbox_answered(qRevision))
+    sysInfo.boardRevision = qRevision->value;
+  if (mbox_answered(qArmMem)) {
+    sysInfo.armMemBase = qArmMem->base;
+    sysInfo.armMemSize = qArmMem->size;
+  }
+  if (mbox_answered(qArmClock))
+    sysInfo.armClock = qArmClock->value;
+  if (mbox_answered(qCoreClock))
+    sysInfo.coreClock = qCoreClock->value;
+  if (mbox_answered(qTemperature))
+    sysInfo.temperature = qTemperature->value;
+  if (mbox_answered(qDmaChannels))
+    sysInfo.dmaChannels = qDmaChannels->value;
+
+  qRevision = 0;
+}
@@ -1,10 +1,15 @@
 // ----------------------------------- mbox.h -------------------------------------
 #include "gpio.h"
 
-/* a properly aligned buffer */
-extern volatile unsigned int mBuf[36];
+/* a properly aligned buffer, in whole cache lines (the boot message batches
+ * the frame buffer setup with the system queries, up to 84 words) */
+#define MBOX_BUF_WORDS 96
+extern volatile unsigned int mBuf[MBOX_BUF_WORDS];
 #define ADDR(X) (unsigned int)((unsigned long)X)
 
+/* buffers for calls in flight at the same time (mbox_get/mbox_submit) */
+#define MBOX_POOL_SIZE 4
+
 /* Registers */
 #define VIDEOCORE_MBOX (MMIO_BASE + 0x0000B880)
 #define MBOX0_READ ((volatile unsigned int*)(VIDEOCORE_MBOX + 0x00))
@@ -26,6 +31,9 @@ extern volatile unsigned int mBuf[36];
 #define MBOX_FULL 0x80000000
 #define MBOX_EMPTY 0x40000000
 
+// Config Value: interrupt when an answer is waiting in mailbox 0
+#define MBOX_CONFIG_IRQ 0x1
+
 /* channels */
 #define MBOX_CH_POWER 0  // Power management
 #define MBOX_CH_FB 1     // Frame buffer
@@ -45,6 +53,7 @@ extern volatile unsigned int mBuf[36];
 #define MBOX_TAG_GETTEMPERATURE 0x00030006  // Get temperature
 #define MBOX_TAG_GETCLKRATE 0x00030002      // Get clock rate
 #define MBOX_TAG_SETCLKRATE 0x00038002      // Set clock rate
+#define MBOX_TAG_GETDMACHANNELS 0x00060001  // Get DMA channels usable by the ARM
 #define MBOX_TAG_LAST 0
 
 // New Tags for Screen Display
@@ -55,6 +64,80 @@ extern volatile unsigned int mBuf[36];
 #define MBOX_TAG_SETPXLORDR 0x48006
 #define MBOX_TAG_GETFB 0x40001
 #define MBOX_TAG_GETPITCH 0x40008
+#define MBOX_TAG_SETPALETTE 0x4800B
+
+// Clock ids for MBOX_TAG_GETCLKRATE
+#define MBOX_CLK_ARM 3
+#define MBOX_CLK_CORE 4
+
+/* Value buffer of each tag, sized for both the request and the response.
+ * MBOX_ADD() takes the size from here, so a tag can only be added with
+ * the layout it is declared with */
+typedef struct { unsigned int value; } MboxWord;
+typedef struct { unsigned int width, height; } MboxSize;
+typedef struct { unsigned int x, y; } MboxOffset;
+typedef struct { unsigned int base, size; } MboxRange;  // GETFB: base is the alignment
+typedef struct { unsigned int id, value; } MboxIdValue;
+typedef struct { unsigned int first, count, colors[16]; } MboxPalette16;  // answer: 0 in first if valid
+
+#define MBOX_TYPE_GETREVISION MboxWord
+#define MBOX_TYPE_GETARMMEM MboxRange
+#define MBOX_TYPE_GETTEMPERATURE MboxIdValue
+#define MBOX_TYPE_GETCLKRATE MboxIdValue
+#define MBOX_TYPE_GETDMACHANNELS MboxWord
+#define MBOX_TYPE_SETPHYWH MboxSize
+#define MBOX_TYPE_SETVIRTWH MboxSize
+#define MBOX_TYPE_SETVIRTOFF MboxOffset
+#define MBOX_TYPE_SETDEPTH MboxWord
+#define MBOX_TYPE_SETPXLORDR MboxWord
+#define MBOX_TYPE_GETFB MboxRange
+#define MBOX_TYPE_GETPITCH MboxWord
+#define MBOX_TYPE_SETPALETTE MboxPalette16
+
+/* Property message being built in a buffer: tags are appended one after
+ * the other and each one's value buffer is returned, to fill in the
+ * request and to read the answer from once the call is done */
+typedef struct {
+  volatile unsigned int *buf;
+  unsigned int words;  // used so far, header included
+  int overflow;        // a tag did not fit, the message will not be sent
+} MboxMsg;
+
+// Append tag MBOX_TAG_<name>, returns its value buffer as MBOX_TYPE_<name>
+#define MBOX_ADD(msg, name) \
+  ((volatile MBOX_TYPE_##name *)mbox_addTag((msg), MBOX_TAG_##name, sizeof(MBOX_TYPE_##name)))
+
+// What the boot message asks for besides the frame buffer (0 if unknown)
+typedef struct {
+  unsigned int boardRevision;
+  unsigned int armMemBase, armMemSize;  // the GPU's memory starts above
+  unsigned int armClock, coreClock;     // Hz
+  unsigned int temperature;             // thousandths of a degree C
+  unsigned int dmaChannels;             // bit per channel the ARM may use
+} SysInfo;
+
+extern SysInfo sysInfo;
 
 /* Function Prototypes */
-int mbox_call(unsigned int buffer_addr, unsigned char channel);
\ No newline at end of file
+int mbox_call(unsigned int buffer_addr, unsigned char channel);
+
+// Building property messages
+void mbox_start(MboxMsg *msg, volatile unsigned int *buf);
+volatile void *mbox_addTag(MboxMsg *msg, unsigned int tag, unsigned int size);
+int mbox_finish(MboxMsg *msg);
+int mbox_send(MboxMsg *msg);
+int mbox_answered(volatile void *value);
+
+// Batch the system queries into a message, read them into sysInfo after
+void mbox_addSysInfo(MboxMsg *msg);
+void mbox_readSysInfo();
+
+// Asynchronous calls: fill a buffer from mbox_get(), submit it, then poll
+// or wait for the answer and release the buffer
+volatile unsigned int *mbox_get();
+int mbox_submit(volatile unsigned int *buf, unsigned char channel);
+int mbox_poll(int handle);
+int mbox_wait(int handle);
+void mbox_release(int handle);
+void mbox_enableIrq();
+void mbox_irq();
\ No newline at end of file
@@ -0,0 +1,153 @@
+// ----------------------------------- mmu.c -------------------------------------
+#include "mmu.h"
+
+#include "mbox.h"
+
+/* Memory attributes (MAIR_EL1), one byte per index */
+#define MT_NORMAL 0     // Normal memory, write-back cacheable
+#define MT_DEVICE 1     // Device-nGnRE (peripherals)
+#define MT_NORMAL_NC 2  // Normal memory, non-cacheable (write combining)
+#define MAIR_VALUE ((0xFFUL << (8 * MT_NORMAL)) | (0x04UL << (8 * MT_DEVICE)) | (0x44UL << (8 * MT_NORMAL_NC)))
+
+/* Translation control (TCR_EL1): 4GB of virtual addresses from TTBR0
+ * (walks start at level 1), 4KB granule, cacheable inner shareable walks,
+ * TTBR1 walks disabled, 32-bit physical addresses */
+#define TCR_T0SZ (64 - 32)
+#define TCR_IRGN0_WBWA (1UL << 8)
+#define TCR_ORGN0_WBWA (1UL << 10)
+#define TCR_SH0_INNER (3UL << 12)
+#define TCR_EPD1 (1UL << 23)
+#define TCR_VALUE (TCR_T0SZ | TCR_IRGN0_WBWA | TCR_ORGN0_WBWA | TCR_SH0_INNER | TCR_EPD1)
+
+/* Descriptor bits */
+#define PT_BLOCK 0x1                 // level 1/2 block
+#define PT_TABLE 0x3                 // points to the next level table
+#define PT_ATTR(idx) ((idx) << 2)    // memory attribute index
+#define PT_INNER_SHAREABLE (3 << 8)  // shared between the cores
+#define PT_AF (1 << 10)              // access flag, no faults on first use
+#define PT_XN (3UL << 53)            // never execute (PXN and UXN)
+
+/* System control (SCTLR_EL1) */
+#define SCTLR_M (1 << 0)   // MMU
+#define SCTLR_A (1 << 1)   // alignment checks
+#define SCTLR_C (1 << 2)   // data cache
+#define SCTLR_I (1 << 12)  // instruction cache
+
+#define BLOCK_SIZE (2UL << 20)    // level 2 blocks are 2MB
+#define LOCAL_PERIPHERALS 0x40000000  // ARM local interrupts, core timers, mailboxes
+
+// Where the GPU's memory starts if the mailbox cannot tell us (64MB GPU split)
+#define DEFAULT_ARM_MEM_END 0x3C000000
+
+/* Identity-mapped translation tables: level 1 covers 4GB in 1GB entries,
+ * the first one points to a level 2 table of 2MB blocks */
+unsigned long __attribute__((aligned(4096))) level1[512];
+unsigned long __attribute__((aligned(4096))) level2[512];
+
+/**
+ * Where the ARM's part of the RAM ends (frame buffer lives above), as
+ * answered to the boot message
+ */
+unsigned long mmu_ramEnd() {
+  if (sysInfo.armMemSize != 0)
+    return sysInfo.armMemBase + sysInfo.armMemSize;
+  return DEFAULT_ARM_MEM_END;
+}
+
+/**
+ * Build the translation tables and turn on the MMU and caches of this core
+ * Called once from main(), after framebf_init() made the boot mailbox call
+ */
+void mmu_init() {
+  unsigned long armEnd = mmu_ramEnd();
+
+  // 0 - 1GB in 2MB blocks:
+  // ARM RAM (kernel, stack, heap) cacheable, GPU RAM (frame buffer)
+  // non-cacheable so writes combine and the GPU sees them, then peripherals
+  for (unsigned long i = 0; i < 512; i++) {
+    unsigned long addr = i * BLOCK_SIZE;
+
+    if (addr >= MMIO_BASE)
+      level2[i] = addr | PT_AF | PT_ATTR(MT_DEVICE) | PT_XN | PT_BLOCK;
+    else if (addr >= armEnd)
+      level2[i] = addr | PT_AF | PT_ATTR(MT_NORMAL_NC) | PT_INNER_SHAREABLE | PT_XN | PT_BLOCK;
+    else
+      level2[i] = addr | PT_AF | PT_ATTR(MT_NORMAL) | PT_INNER_SHAREABLE | PT_BLOCK;
+  }
+
+  level1[0] = (unsigned long)level2 | PT_TABLE;
+
+  // 1GB - 2GB: ARM local peripherals as a single 1GB device block
+  level1[1] = LOCAL_PERIPHERALS | PT_AF | PT_ATTR(MT_DEVICE) | PT_XN | PT_BLOCK;
+
+  mmu_enable();
+}
+
+/**
+ * Load the tables built by mmu_init() and enable the MMU and caches
+ */
+void mmu_enable() {
+  unsigned long r;
+
+  asm volatile("msr mair_el1, %0" ::"r"(MAIR_VALUE));
+  asm volatile("msr tcr_el1, %0" ::"r"(TCR_VALUE));
+  asm volatile("msr ttbr0_el1, %0" ::"r"((unsigned long)level1));
+  asm volatile("dsb ish; isb");
+
+  // Drop any stale translations
+  asm volatile("tlbi vmalle1; dsb ish; isb");
+
+  asm volatile("mrs %0, sctlr_el1"
+               : "=r"(r));
+  r |= SCTLR_M | SCTLR_C | SCTLR_I;
+  r &= ~SCTLR_A;
+  asm volatile("msr sctlr_el1, %0; isb" ::"r"(r));
+}
+
+// Smallest data cache line in bytes
+static unsigned long dcacheLine() {
+  unsigned long ctr;
+  asm volatile("mrs %0, ctr_el0"
+               : "=r"(ctr));
+  return 4UL << ((ctr >> 16) & 0xf);
+}
+
+/**
+ * Write dirty lines of a range back to RAM (before the GPU reads it)
+ */
+void dcache_clean(volatile void *start, unsigned long size) {
+  unsigned long line = dcacheLine();
+  unsigned long addr = (unsigned long)start & ~(line - 1);
+
+  for (; addr < (unsigned long)start + size; addr += line)
+    asm volatile("dc cvac, %0" ::"r"(addr)
+                 : "memory");
+  asm volatile("dsb sy" ::: "memory");
+}
+
+/**
+ * Discard cached lines of a range (after the GPU wrote it)
+ * The range should cover whole cache lines, or neighbours lose their writes
+ */
+void dcache_invalidate(volatile void *start, unsigned long size) {
+  unsigned long line = dcacheLine();
+  unsigned long addr = (unsigned long)start & ~(line - 1);
+
+  for (; addr < (unsigned long)start + size; addr += line)
+    asm volatile("dc ivac, %0" ::"r"(addr)
+                 : "memory");
+  asm volatile("dsb sy" ::: "memory");
+}
+
+/**
+ * Write back then discard cached lines of a range
+ */
+void dcache_clean_invalidate(volatile void *start, unsigned long size) {
+  unsigned long line = dcacheLine();
+  unsigned long addr = (unsigned long)start & ~(line - 1);
+
+  for (; addr < (unsigned long)start + size; addr += line)
+    asm volatile("dc civac, %0" ::"r"(addr)
+                 : "memory");
+  asm volatile("dsb sy" ::: "memory");
+}
@@ -0,0 +1,9 @@
+// ----------------------------------- mmu.h -------------------------------------
+void mmu_init();
+void mmu_enable();
+unsigned long mmu_ramEnd();
+
+// Data cache maintenance by address range, for memory shared with the GPU
+void dcache_clean(volatile void *start, unsigned long size);
+void dcache_invalidate(volatile void *start, unsigned long size);
+void dcache_clean_invalidate(volatile void *start, unsigned long size);
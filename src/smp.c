@@ -0,0 +1,171 @@
+// ----------------------------------- smp.c -------------------------------------
+#include "smp.h"
+
+#include "mmu.h"
+
+/* Spin-table: the firmware (and QEMU) park cores 1-3 polling these
+ * addresses, a core jumps to the address written in its slot */
+#define SPIN_TABLE_BASE 0xd8UL
+#define SPIN_TABLE(core) ((volatile unsigned long *)(SPIN_TABLE_BASE + 8 * (core)))
+
+// How long smp_init() waits for the cores to check in (microseconds)
+#define BRINGUP_TIMEOUT 100000
+
+extern char _start_secondary[];  // boot.S
+
+// One pending job per core, posted by smp_run_on()
+typedef struct {
+  smp_fn fn;
+  void *arg;
+  atomic_uint busy;
+} Job;
+
+static Job jobs[NUM_CORES];
+static atomic_uint online[NUM_CORES];
+
+static inline void sev() { asm volatile("sev"); }
+static inline void wfe() { asm volatile("wfe"); }
+
+/**
+ * Number of the core running this code (0-3)
+ */
+int smp_core_id() {
+  unsigned long mpidr;
+  asm volatile("mrs %0, mpidr_el1"
+               : "=r"(mpidr));
+  return mpidr & 3;
+}
+
+/**
+ * C entry of cores 1-3, called from boot.S at EL1 on the core's own stack
+ * Runs the jobs posted by smp_run_on(), sleeping in between
+ */
+void smp_secondary_main(int core) {
+  // Same tables as core 0; atomics need the caches on to work across cores
+  mmu_enable();
+
+  Job *job = &jobs[core];
+  atomic_store_explicit(&online[core], 1, memory_order_release);
+  sev();
+
+  while (1) {
+    while (!atomic_load_explicit(&job->busy, memory_order_acquire))
+      wfe();
+
+    job->fn(job->arg);
+
+    atomic_store_explicit(&job->busy, 0, memory_order_release);
+    sev();  // wake smp_wait()
+  }
+}
+
+/**
+ * Release cores 1-3 from the spin-table and wait for them to come online
+ * Call after mmu_init() (from main)
+ */
+void smp_init() {
+  atomic_store(&online[0], 1);
+
+  for (int core = 1; core < NUM_CORES; core++) {
+    *SPIN_TABLE(core) = (unsigned long)_start_secondary;
+    // The parked cores have their caches off, push the slot out to RAM
+    dcache_clean(SPIN_TABLE(core), sizeof(unsigned long));
+  }
+  sev();
+
+  // Give up on cores that never start (e.g. QEMU with fewer than 4)
+  unsigned long f, t, r;
+  asm volatile("mrs %0, cntfrq_el0"
+               : "=r"(f));
+  asm volatile("mrs %0, cntpct_el0"
+               : "=r"(t));
+  do {
+    if (smp_cores_online() == NUM_CORES)
+      break;
+    asm volatile("mrs %0, cntpct_el0"
+                 : "=r"(r));
+  } while (r < t + f / 1000000 * BRINGUP_TIMEOUT);
+}
+
+/**
+ * Number of cores that finished bring-up (including core 0)
+ */
+int smp_cores_online() {
+  int n = 0;
+  for (int core = 0; core < NUM_CORES; core++)
+    n += atomic_load_explicit(&online[core], memory_order_acquire);
+  return n;
+}
+
+/**
+ * Run fn(arg) on a core
+ * Runs inline on the calling core, otherwise the call is posted and returns
+ * at once. Returns 0 if the core is offline or still busy with a job
+ */
+int smp_run_on(int core, smp_fn fn, void *arg) {
+  if (core < 0 || core >= NUM_CORES || !atomic_load(&online[core]))
+    return 0;
+
+  if (core == smp_core_id()) {
+    fn(arg);
+    return 1;
+  }
+
+  Job *job = &jobs[core];
+  if (atomic_load_explicit(&job->busy, memory_order_acquire))
+    return 0;
+
+  job->fn = fn;
+  job->arg = arg;
+  atomic_store_explicit(&job->busy, 1, memory_order_release);
+  sev();
+  return 1;
+}
+
+/**
+ * Is a job still running on a core?
+ */
+int smp_busy(int core) {
+  return atomic_load_explicit(&jobs[core].busy, memory_order_acquire);
+}
+
+/**
+ * Wait for the job posted to a core to finish
+ */
+void smp_wait(int core) {
+  while (smp_busy(core))
+    wfe();
+}
+
+void spin_lock(spinlock_t *lock) {
+  while (atomic_flag_test_and_set_explicit(&lock->locked, memory_order_acquire))
+    wfe();
+}
+
+void spin_unlock(spinlock_t *lock) {
+  atomic_flag_clear_explicit(&lock->locked, memory_order_release);
+  sev();
+}
+
+void barrier_init(barrier_t *barrier, unsigned int cores) {
+  atomic_init(&barrier->count, 0);
+  atomic_init(&barrier->generation, 0);
+  barrier->cores = cores;
+}
+
+/**
+ * Block until barrier->cores cores have called this, then release them all
+ */
+void barrier_wait(barrier_t *barrier) {
+  unsigned int gen = atomic_load_explicit(&barrier->generation, memory_order_acquire);
+
+  if (atomic_fetch_add_explicit(&barrier->count, 1, memory_order_acq_rel) + 1 == barrier->cores) {
+    // Last one in: reset for the next round and open the barrier
+    atomic_store_explicit(&barrier->count, 0, memory_order_relaxed);
+    atomic_fetch_add_explicit(&barrier->generation, 1, memory_order_release);
+    sev();
+  } else {
+    while (atomic_load_explicit(&barrier->generation, memory_order_acquire) == gen)
+      wfe();
+  }
+}
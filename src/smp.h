@@ -0,0 +1,35 @@
+// ----------------------------------- smp.h -------------------------------------
+#include <stdatomic.h>
+
+#define NUM_CORES 4
+
+typedef void (*smp_fn)(void *arg);
+
+// Spinlock (test-and-set on one flag)
+typedef struct {
+  atomic_flag locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT \
+  { ATOMIC_FLAG_INIT }
+
+// Barrier for a fixed number of cores, reusable across rounds
+typedef struct {
+  atomic_uint count;
+  atomic_uint generation;
+  unsigned int cores;
+} barrier_t;
+
+// Core bring-up and work dispatch
+void smp_init();
+int smp_core_id();
+int smp_cores_online();
+int smp_run_on(int core, smp_fn fn, void *arg);
+int smp_busy(int core);
+void smp_wait(int core);
+
+// Synchronization
+void spin_lock(spinlock_t *lock);
+void spin_unlock(spinlock_t *lock);
+void barrier_init(barrier_t *barrier, unsigned int cores);
+void barrier_wait(barrier_t *barrier);
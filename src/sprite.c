@@ -0,0 +1,272 @@
+// ----------------------------------- sprite.c -------------------------------------
+#include "sprite.h"
+
+#include "blit.h"
+#include "framebf.h"
+#include "tile.h"
+#include "uart.h"
+
+// Off-screen atlas every sprite is pre-rendered into, in the screen's pixel format
+#define ATLAS_WIDTH 512
+#define ATLAS_HEIGHT 256
+
+// Total number of opaque runs over all sprites
+#define SPRITE_MAX_RUNS 2048
+
+// Collision mask words over all sprites (a row takes one per 64 pixels)
+#define SPRITE_MASK_WORDS 2048
+
+// One horizontal run of opaque pixels, relative to the sprite's corner
+struct SpriteRun {
+  unsigned short x;
+  unsigned short y;
+  unsigned short len;
+};
+
+// Cell of the atlas holding a sprite, and its list of opaque runs
+struct Sprite {
+  int x;
+  int y;
+  int width;
+  int height;
+  int firstRun;
+  int numRuns;
+  int firstMask;  // collision mask rows, rowWords words each
+  int rowWords;   // 0 if the sprite has no mask
+};
+
+pixel_t __attribute__((aligned(16))) atlas[ATLAS_HEIGHT][ATLAS_WIDTH];
+
+struct Sprite sprites[SPRITE_MAX];
+int numSprites = 0;
+
+// The runs are the transparency mask: only what they cover gets copied
+struct SpriteRun spriteRuns[SPRITE_MAX_RUNS];
+int numSpriteRuns = 0;
+
+// One bit per pixel, set where the sprite's shape is: pixel x of a row is
+// bit x % 64 of the row's word x / 64
+unsigned long spriteMasks[SPRITE_MASK_WORDS];
+int numSpriteMaskWords = 0;
+
+// Sprites are packed left to right on shelves as tall as their tallest sprite
+int shelfX = 0, shelfY = 0, shelfHeight = 0;
+
+// Reserve a width x height cell in the atlas and redirect drawing into it,
+// with (0, 0) at the cell's top-left corner. Returns the sprite id, or -1
+// if the atlas is full
+int spriteBegin(int width, int height) {
+  if (numSprites == SPRITE_MAX || width > ATLAS_WIDTH)
+    return -1;
+
+  // Start a new shelf if this one is full
+  if (shelfX + width > ATLAS_WIDTH) {
+    shelfY += shelfHeight;
+    shelfX = 0;
+    shelfHeight = 0;
+  }
+  if (shelfY + height > ATLAS_HEIGHT)
+    return -1;
+
+  struct Sprite *sprite = &sprites[numSprites];
+  sprite->x = shelfX;
+  sprite->y = shelfY;
+  sprite->width = width;
+  sprite->height = height;
+  sprite->firstRun = numSpriteRuns;
+  sprite->numRuns = 0;
+  sprite->firstMask = numSpriteMaskWords;
+  sprite->rowWords = 0;
+
+  shelfX += width;
+  if (height > shelfHeight)
+    shelfHeight = height;
+
+  // Start from a fully transparent cell
+  framebf_setTarget((unsigned char *)&atlas[sprite->y][sprite->x], ATLAS_WIDTH * BYTES_PER_PIXEL, width, height);
+  drawRect(0, 0, width - 1, height - 1, 0x00, 1);
+
+  return numSprites++;
+}
+
+// Bit of pixel x in a mask row
+static int maskBit(const unsigned long *row, int x) {
+  return (row[x / 64] >> (x % 64)) & 1;
+}
+
+// Build a sprite's collision mask from its cell of the atlas. The shape is
+// everything but the transparent pixels reachable from the cell's edge:
+// black drawn inside it (the chickens' eyes) is the colour key, but still
+// part of the chicken. Returns 0 if there is no room for the mask
+static int buildMask(struct Sprite *sprite) {
+  int w = sprite->width, h = sprite->height;
+  int rowWords = (w + 63) / 64;
+  unsigned long *mask = &spriteMasks[numSpriteMaskWords];
+
+  if (numSpriteMaskWords + rowWords * h > SPRITE_MASK_WORDS)
+    return 0;
+
+  for (int i = 0; i < rowWords * h; i++)
+    mask[i] = 0;
+
+  // Mark the outside, sweeping forward and back until it stops growing
+  for (int pass = 0, changed = 1; changed; pass++) {
+    changed = 0;
+    for (int k = 0; k < w * h; k++) {
+      int i = (pass & 1) ? w * h - 1 - k : k;
+      int x = i % w, y = i / w;
+      unsigned long *row = &mask[y * rowWords];
+
+      if (maskBit(row, x) || atlas[sprite->y + y][sprite->x + x] != SPRITE_TRANSPARENT)
+        continue;
+      if (x == 0 || y == 0 || x == w - 1 || y == h - 1 ||
+          maskBit(row, x - 1) || maskBit(row, x + 1) ||
+          maskBit(row - rowWords, x) || maskBit(row + rowWords, x)) {
+        row[x / 64] |= 1UL << (x % 64);
+        changed = 1;
+      }
+    }
+  }
+
+  // The shape is the rest, nothing past the last pixel of a row
+  for (int y = 0; y < h; y++) {
+    unsigned long *row = &mask[y * rowWords];
+    for (int i = 0; i < rowWords; i++)
+      row[i] = ~row[i];
+    if (w % 64)
+      row[rowWords - 1] &= (1UL << (w % 64)) - 1;
+  }
+
+  sprite->firstMask = numSpriteMaskWords;
+  sprite->rowWords = rowWords;
+  numSpriteMaskWords += rowWords * h;
+  return 1;
+}
+
+// Finish drawing a sprite: go back to the screen and build its opaque runs
+// and collision mask
+void spriteEnd(int id) {
+  framebf_resetTarget();
+
+  if (id < 0 || id >= numSprites)
+    return;
+
+  // The mask first, it stays whole even if the runs do not fit (without
+  // one the sprite collides by its box)
+  struct Sprite *sprite = &sprites[id];
+  if (!buildMask(sprite))
+    uart_puts("Sprite atlas is out of mask words\n");
+
+  for (int y = 0; y < sprite->height; y++) {
+    pixel_t *row = &atlas[sprite->y + y][sprite->x];
+    int x = 0;
+
+    while (x < sprite->width) {
+      // Skip transparent pixels, then measure the opaque run
+      while (x < sprite->width && row[x] == SPRITE_TRANSPARENT)
+        x++;
+      int start = x;
+      while (x < sprite->width && row[x] != SPRITE_TRANSPARENT)
+        x++;
+
+      if (x > start) {
+        if (numSpriteRuns == SPRITE_MAX_RUNS) {
+          uart_puts("Sprite atlas is out of runs\n");
+          return;
+        }
+        spriteRuns[numSpriteRuns].x = start;
+        spriteRuns[numSpriteRuns].y = y;
+        spriteRuns[numSpriteRuns].len = x - start;
+        numSpriteRuns++;
+        sprite->numRuns++;
+      }
+    }
+  }
+}
+
+// Copy a sprite's opaque pixels to the drawing surface, top-left at (x, y)
+// Sprites crossing the clip rectangle have their runs trimmed
+void blitSprite(int id, int x, int y) {
+  if (id < 0 || id >= numSprites)
+    return;
+
+  DrawTarget *t = drawTarget();
+  ClipRect *c = &t->clipRect;
+  struct Sprite *sprite = &sprites[id];
+  struct SpriteRun *run = &spriteRuns[sprite->firstRun];
+  int x2 = x + sprite->width - 1, y2 = y + sprite->height - 1;
+
+  if (tileBinning) {
+    DrawCmd cmd = {CMD_SPRITE, 0, {id, x, y}};
+    if (tile_record(&cmd, x, y, x2, y2))
+      return;
+  }
+
+  if (x2 < c->x1 || x > c->x2 || y2 < c->y1 || y > c->y2)
+    return;
+  int inside = x >= c->x1 && x2 <= c->x2 && y >= c->y1 && y2 <= c->y2;
+
+  for (int i = 0; i < sprite->numRuns; i++, run++) {
+    int runx = x + run->x, runy = y + run->y;
+    int skip = 0, len = run->len;
+
+    if (!inside) {
+      if (runy < c->y1 || runy > c->y2)
+        continue;
+      if (runx < c->x1)
+        skip = c->x1 - runx;
+      if (runx + len - 1 > c->x2)
+        len = c->x2 - runx + 1;
+      len -= skip;
+      if (len <= 0)
+        continue;
+    }
+
+    blitCopy(t->buf + (runy * t->bufPitch) + ((runx + skip) * BYTES_PER_PIXEL),
+             (unsigned char *)&atlas[sprite->y + run->y][sprite->x + run->x + skip],
+             len * BYTES_PER_PIXEL);
+  }
+}
+
+// 64 mask bits of a sprite row from pixel x on, 0 past its end
+static unsigned long maskBits(const unsigned long *row, int rowWords, int x) {
+  int w = x / 64, shift = x % 64;
+  unsigned long bits = (w < rowWords) ? row[w] >> shift : 0;
+
+  if (shift && w + 1 < rowWords)
+    bits |= row[w + 1] << (64 - shift);
+  return bits;
+}
+
+// Do the shapes of two sprites, top-left at (ax, ay) and (bx, by),
+// overlap? Their boxes are tested first, then the rows where they
+// overlap are ANDed 64 pixels at a time. A sprite without a mask is solid
+int spriteCollide(int a, int ax, int ay, int b, int bx, int by) {
+  if (a < 0 || a >= numSprites || b < 0 || b >= numSprites)
+    return 0;
+
+  struct Sprite *sa = &sprites[a], *sb = &sprites[b];
+  int x1 = (ax > bx) ? ax : bx, y1 = (ay > by) ? ay : by;
+  int x2 = (ax + sa->width < bx + sb->width) ? ax + sa->width : bx + sb->width;
+  int y2 = (ay + sa->height < by + sb->height) ? ay + sa->height : by + sb->height;
+
+  // The boxes do not even overlap
+  if (x1 >= x2 || y1 >= y2)
+    return 0;
+  if (!sa->rowWords || !sb->rowWords)
+    return 1;
+
+  for (int y = y1; y < y2; y++) {
+    const unsigned long *rowA = &spriteMasks[sa->firstMask + (y - ay) * sa->rowWords];
+    const unsigned long *rowB = &spriteMasks[sb->firstMask + (y - by) * sb->rowWords];
+
+    for (int x = x1; x < x2; x += 64) {
+      unsigned long bits = maskBits(rowA, sa->rowWords, x - ax) & maskBits(rowB, sb->rowWords, x - bx);
+      if (x2 - x < 64)
+        bits &= (1UL << (x2 - x)) - 1;
+      if (bits)
+        return 1;
+    }
+  }
+  return 0;
+}
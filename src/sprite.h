@@ -0,0 +1,12 @@
+// ----------------------------------- sprite.h -------------------------------------
+// Maximum number of sprites in the atlas
+#define SPRITE_MAX 16
+
+// Pixels of this value are left out when blitting (black, vgapal[0], is 0
+// in every pixel format)
+#define SPRITE_TRANSPARENT 0x000000
+
+int spriteBegin(int width, int height);
+void spriteEnd(int id);
+void blitSprite(int id, int x, int y);
+int spriteCollide(int a, int ax, int ay, int b, int bx, int by);
@@ -0,0 +1,312 @@
+// ----------------------------------- tile.c -------------------------------------
+#include "framebf.h"
+
+#include "blit.h"
+#include "dma.h"
+#include "smp.h"
+#include "sprite.h"
+#include "tile.h"
+
+// Tile grid over the whole screen
+#define TILE_COLS ((WIDTH + TILE_SIZE - 1) / TILE_SIZE)
+#define TILE_ROWS ((HEIGHT + TILE_SIZE - 1) / TILE_SIZE)
+#define TILE_COUNT (TILE_COLS * TILE_ROWS)
+
+// Recorded commands per frame, and references to them from all the tiles
+// together. When either runs out, what was recorded so far is drawn
+#define TILE_MAX_CMDS 1024
+#define TILE_MAX_REFS 8192
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+int tileBinning = 0;
+int tileReplaying = 0;
+
+// Commands in drawing order, and the part of the screen each one touches
+DrawCmd tileCmds[TILE_MAX_CMDS];
+ClipRect tileCmdBox[TILE_MAX_CMDS];
+int numTileCmds = 0, numTileRefs = 0;
+
+// Bins: how many commands touch each tile, then where each tile's list of
+// command indexes starts in tileRefs (the lists keep drawing order)
+unsigned short tileRefCount[TILE_COUNT];
+unsigned short tileRefStart[TILE_COUNT + 1];
+unsigned short tileRefs[TILE_MAX_REFS];
+
+// Surface the frame is binned for (the back buffer) and its visible part
+unsigned char *binTarget;
+unsigned int binPitch;
+ClipRect binBounds;
+
+// Next tile to draw, taken by whichever core is free
+atomic_uint nextTile;
+
+// Tiles filled by the DMA engine instead, while the cores draw the others
+unsigned char tileByDma[TILE_COUNT];
+
+// Per-core tile buffer: tiles are drawn here, in cacheable memory, then
+// copied out once so each frame buffer line is written a single time
+pixel_t __attribute__((aligned(64))) tileBuffers[DRAW_CORES][TILE_SIZE * TILE_SIZE];
+
+/**
+ * Start recording a frame for the surface being drawn (the back buffer)
+ * Drawing calls are binned into tiles instead of drawn, until tile_end()
+ */
+void tile_begin() {
+  DrawTarget *t = drawTarget();
+
+  binTarget = t->buf;
+  binPitch = t->bufPitch;
+  binBounds.x1 = MAX(t->clipRect.x1, 0);
+  binBounds.y1 = MAX(t->clipRect.y1, 0);
+  binBounds.x2 = MIN(t->clipRect.x2, WIDTH - 1);
+  binBounds.y2 = MIN(t->clipRect.y2, HEIGHT - 1);
+
+  numTileCmds = 0;
+  numTileRefs = 0;
+  for (int i = 0; i < TILE_COUNT; i++)
+    tileRefCount[i] = 0;
+
+  tileBinning = 1;
+}
+
+/**
+ * Draw the recorded frame and go back to drawing immediately
+ */
+void tile_end() {
+  tile_flush();
+  tileBinning = 0;
+}
+
+/**
+ * Record a drawing call touching the box x1, y1 - x2, y2 (inclusive)
+ * Returns 0 if the call must be drawn right away instead (drawing off-screen)
+ */
+int tile_record(DrawCmd *cmd, int x1, int y1, int x2, int y2) {
+  DrawTarget *t = drawTarget();
+
+  if (t->buf != binTarget)
+    return 0;
+
+  // Only the visible part of the box decides which tiles it lands in
+  x1 = MAX(x1, MAX(t->clipRect.x1, binBounds.x1));
+  y1 = MAX(y1, MAX(t->clipRect.y1, binBounds.y1));
+  x2 = MIN(x2, MIN(t->clipRect.x2, binBounds.x2));
+  y2 = MIN(y2, MIN(t->clipRect.y2, binBounds.y2));
+  if (x1 > x2 || y1 > y2)
+    return 1;
+
+  int refs = (x2 / TILE_SIZE - x1 / TILE_SIZE + 1) * (y2 / TILE_SIZE - y1 / TILE_SIZE + 1);
+  if (numTileCmds == TILE_MAX_CMDS || numTileRefs + refs > TILE_MAX_REFS)
+    tile_flush();
+
+  DrawCmd *c = &tileCmds[numTileCmds];
+  *c = *cmd;
+  c->clipRect = t->clipRect;
+  tileCmdBox[numTileCmds].x1 = x1;
+  tileCmdBox[numTileCmds].y1 = y1;
+  tileCmdBox[numTileCmds].x2 = x2;
+  tileCmdBox[numTileCmds].y2 = y2;
+  numTileCmds++;
+
+  for (int ty = y1 / TILE_SIZE; ty <= y2 / TILE_SIZE; ty++) {
+    for (int tx = x1 / TILE_SIZE; tx <= x2 / TILE_SIZE; tx++)
+      tileRefCount[ty * TILE_COLS + tx]++;
+  }
+  numTileRefs += refs;
+
+  return 1;
+}
+
+// Sort the command indexes into per-tile lists, in drawing order
+static void buildBins() {
+  tileRefStart[0] = 0;
+  for (int t = 0; t < TILE_COUNT; t++) {
+    tileRefStart[t + 1] = tileRefStart[t] + tileRefCount[t];
+    tileRefCount[t] = 0;  // reused as the fill position
+  }
+
+  for (int i = 0; i < numTileCmds; i++) {
+    ClipRect *box = &tileCmdBox[i];
+
+    for (int ty = box->y1 / TILE_SIZE; ty <= box->y2 / TILE_SIZE; ty++) {
+      for (int tx = box->x1 / TILE_SIZE; tx <= box->x2 / TILE_SIZE; tx++) {
+        int t = ty * TILE_COLS + tx;
+        tileRefs[tileRefStart[t] + tileRefCount[t]++] = i;
+      }
+    }
+  }
+}
+
+// Does a command paint every pixel of a tile in one solid color?
+// Then whatever was on screen before does not need to be read back
+static int coversTile(int i, ClipRect *tile) {
+  DrawCmd *cmd = &tileCmds[i];
+  ClipRect *box = &tileCmdBox[i];
+
+  if (box->x1 > tile->x1 || box->y1 > tile->y1 || box->x2 < tile->x2 || box->y2 < tile->y2)
+    return 0;
+
+  return cmd->type == CMD_CLEAR ||
+         (cmd->type == CMD_RECT && cmd->arg[4] && (cmd->attr >> 4) == (cmd->attr & 0x0f));
+}
+
+// Part of the screen tile t covers
+static void tileRect(int t, ClipRect *tile) {
+  tile->x1 = MAX((t % TILE_COLS) * TILE_SIZE, binBounds.x1);
+  tile->y1 = MAX((t / TILE_COLS) * TILE_SIZE, binBounds.y1);
+  tile->x2 = MIN((t % TILE_COLS) * TILE_SIZE + TILE_SIZE - 1, binBounds.x2);
+  tile->y2 = MIN((t / TILE_COLS) * TILE_SIZE + TILE_SIZE - 1, binBounds.y2);
+}
+
+// Queue DMA fills for the tiles whose only command paints them in one
+// color, returns how many were queued
+static int queueDmaTiles() {
+  int queued = 0;
+  ClipRect tile;
+
+  for (int t = 0; t < TILE_COUNT; t++) {
+    int first = tileRefStart[t];
+
+    tileByDma[t] = 0;
+    if (fbDma < 0 || tileRefStart[t + 1] - first != 1)
+      continue;
+
+    tileRect(t, &tile);
+    if (!coversTile(tileRefs[first], &tile))
+      continue;
+
+    DrawCmd *cmd = &tileCmds[tileRefs[first]];
+    int color = (cmd->type == CMD_CLEAR) ? 0 : (cmd->attr & 0x0f);
+    if (framebf_queueFill(binTarget, binPitch, &tile, color)) {
+      tileByDma[t] = 1;
+      queued++;
+    }
+  }
+  return queued;
+}
+
+// Replay one recorded command with the calling core's target and clip
+static void drawCmd(DrawCmd *cmd) {
+  int *a = cmd->arg;
+
+  switch (cmd->type) {
+    case CMD_PIXEL:
+      drawPixel(a[0], a[1], cmd->attr);
+      break;
+    case CMD_RECT:
+      drawRect(a[0], a[1], a[2], a[3], cmd->attr, a[4]);
+      break;
+    case CMD_LINE:
+      drawLine(a[0], a[1], a[2], a[3], cmd->attr);
+      break;
+    case CMD_ELLIPSE:
+      drawEllipse(a[0], a[1], a[2], a[3], cmd->attr, a[4]);
+      break;
+    case CMD_CHAR:
+      drawChar(a[0], a[1], a[2], cmd->attr, a[3]);
+      break;
+    case CMD_SPRITE:
+      blitSprite(a[0], a[1], a[2]);
+      break;
+    case CMD_CLEAR:
+      clearScreen(a[0], a[1]);
+      break;
+  }
+}
+
+// Draw tile t in the calling core's tile buffer and copy it to the screen
+static void drawTile(int t) {
+  int first = tileRefStart[t], last = tileRefStart[t + 1];
+  DrawTarget *target = drawTarget();
+  pixel_t *buffer = tileBuffers[drawCore()];
+  ClipRect tile;
+
+  if (first == last || tileByDma[t])
+    return;
+
+  tileRect(t, &tile);
+
+  unsigned int tilePitch = TILE_SIZE * BYTES_PER_PIXEL;
+  unsigned int rowBytes = (tile.x2 - tile.x1 + 1) * BYTES_PER_PIXEL;
+  int rows = tile.y2 - tile.y1 + 1;
+  unsigned char *screen = binTarget + (tile.y1 * binPitch) + (tile.x1 * BYTES_PER_PIXEL);
+
+  // Start from what is on screen, unless the first command hides it all
+  if (!coversTile(tileRefs[first], &tile))
+    blitRect((unsigned char *)buffer, tilePitch, screen, binPitch, rowBytes, rows);
+
+  // Screen coordinates land in the tile buffer: the pixel at (x1, y1)
+  // is the buffer's first one, and nothing outside the tile is drawn
+  target->buf = (unsigned char *)buffer - (tile.y1 * tilePitch) - (tile.x1 * BYTES_PER_PIXEL);
+  target->bufPitch = tilePitch;
+
+  for (int i = first; i < last; i++) {
+    DrawCmd *cmd = &tileCmds[tileRefs[i]];
+
+    target->clipRect.x1 = MAX(cmd->clipRect.x1, tile.x1);
+    target->clipRect.y1 = MAX(cmd->clipRect.y1, tile.y1);
+    target->clipRect.x2 = MIN(cmd->clipRect.x2, tile.x2);
+    target->clipRect.y2 = MIN(cmd->clipRect.y2, tile.y2);
+    drawCmd(cmd);
+  }
+
+  blitRect(screen, binPitch, (unsigned char *)buffer, tilePitch, rowBytes, rows);
+}
+
+// Draw tiles until there are none left, on any core
+static void drawTiles(void *arg) {
+  DrawTarget *target = drawTarget();
+  DrawTarget saved = *target;
+  unsigned int t;
+
+  while ((t = atomic_fetch_add_explicit(&nextTile, 1, memory_order_relaxed)) < TILE_COUNT)
+    drawTile(t);
+
+  *target = saved;
+
+  // The frame buffer is not cached, make sure the writes left this core
+  asm volatile("dsb sy" ::: "memory");
+}
+
+/**
+ * Draw everything recorded so far, on every core that is online, and
+ * start binning again (called by tile_end(), or when the bins are full)
+ */
+void tile_flush() {
+  int started[NUM_CORES] = {0};
+
+  if (numTileCmds == 0)
+    return;
+
+  buildBins();
+
+  // Tiles that are only cleared go to the DMA engine, it runs alongside
+  int dmaTiles = queueDmaTiles();
+  if (dmaTiles)
+    dma_start(fbDma);
+
+  // Primitives draw for real from here, with the shared caches read only
+  tileBinning = 0;
+  tileReplaying = 1;
+  atomic_store(&nextTile, 0);
+
+  for (int core = 1; core < NUM_CORES; core++)
+    started[core] = smp_run_on(core, drawTiles, 0);
+  drawTiles(0);
+  for (int core = 1; core < NUM_CORES; core++) {
+    if (started[core])
+      smp_wait(core);
+  }
+  if (dmaTiles)
+    dma_wait(fbDma);
+
+  tileReplaying = 0;
+  tileBinning = 1;
+
+  numTileCmds = 0;
+  numTileRefs = 0;
+  for (int i = 0; i < TILE_COUNT; i++)
+    tileRefCount[i] = 0;
+}
@@ -0,0 +1,32 @@
+// ----------------------------------- tile.h -------------------------------------
+// Square screen tiles, 64 x 64 pixels are 16KB at 32bpp and fit in L1
+#define TILE_SIZE 64
+
+// Kinds of draw commands the tile renderer bins
+enum {
+  CMD_PIXEL,    // x, y
+  CMD_RECT,     // x1, y1, x2, y2, fill
+  CMD_LINE,     // x1, y1, x2, y2
+  CMD_ELLIPSE,  // x0, y0, rx, ry, fill
+  CMD_CHAR,     // ch, x, y, zoom
+  CMD_SPRITE,   // id, x, y
+  CMD_CLEAR     // width, height
+};
+
+// One recorded drawing call, with the clip rectangle it was made under
+typedef struct {
+  unsigned char type;
+  unsigned char attr;
+  int arg[5];
+  ClipRect clipRect;
+} DrawCmd;
+
+// Set between tile_begin() and tile_end() (drawing calls are recorded),
+// and while the recorded tiles are drawn (shared caches are read only)
+extern int tileBinning;
+extern int tileReplaying;
+
+void tile_begin();
+void tile_end();
+void tile_flush();
+int tile_record(DrawCmd *cmd, int x1, int y1, int x2, int y2);
@@ -1,7 +1,26 @@
 // ----------------------------------- uart.c -------------------------------------
 #include "uart.h"
 
+#include <stdatomic.h>
+
 #include "gpio.h"
+#include "irq.h"
+
+/* Received bytes, written by the interrupt handler and read by the game.
+ * One producer and one consumer: each index only moves on its own side */
+static struct {
+  unsigned long time;  // counter ticks (cntpct_el0) when the byte was taken
+  unsigned char ch;
+} rxRing[UART_RX_SIZE];
+static atomic_uint rxHead, rxTail;  // free running, masked on access
+static unsigned int rxDropped;
+
+/* Bytes waiting to be sent, drained by the transmit interrupt. Both sides
+ * run on core 0 and the sending side masks interrupts while it updates */
+static unsigned char txRing[UART_TX_SIZE];
+static volatile unsigned int txHead, txTail;  // free running, masked on access
+static unsigned int txDropped;
+static int txPolicy = UART_TX_DROP;
 
 /**
  * Set baud rate and characteristics (152000 8N1) and map to GPIO
@@ -38,34 +57,162 @@ void uart_init() {
   *GPPUDCLK0 = 0;  // flush GPIO setup
 
   *AUX_MU_CNTL = 3;  // Enable transmitter and receiver (Tx, Rx)
+
+  /* received bytes raise an interrupt (taken once irq_init() runs) */
+  *AUX_MU_IER = AUX_MU_IER_RX;
+  *ENABLE_IRQS_1 = IRQ_AUX;
 }
 
 /**
- *	Send a character
+ * Feed the transmitter from the ring while it has room, and stop the
+ * transmit interrupt once everything has been sent
+ */
+IRQ_HANDLER static void txFill() {
+  while (txTail != txHead && (*AUX_MU_LSR & 0x20)) {
+    *AUX_MU_IO = txRing[txTail % UART_TX_SIZE];
+    txTail++;
+  }
+
+  if (txTail == txHead)
+    *AUX_MU_IER &= ~AUX_MU_IER_TX;
+}
+
+/**
+ * UART interrupt: move every byte waiting in the receive FIFO to the ring
+ * (bytes are dropped and counted while it is full), then refill the
+ * transmit FIFO
+ */
+IRQ_HANDLER void uart_irq() {
+  unsigned long now;
+  asm volatile("mrs %0, cntpct_el0"
+               : "=r"(now));
+
+  while (*AUX_MU_LSR & 0x01) {
+    unsigned char c = (unsigned char)(*AUX_MU_IO);
+    unsigned int head = atomic_load_explicit(&rxHead, memory_order_relaxed);
+
+    if (head - atomic_load_explicit(&rxTail, memory_order_acquire) == UART_RX_SIZE) {
+      rxDropped++;
+      continue;
+    }
+
+    rxRing[head % UART_RX_SIZE].ch = c;
+    rxRing[head % UART_RX_SIZE].time = now;
+    atomic_store_explicit(&rxHead, head + 1, memory_order_release);
+  }
+
+  txFill();
+}
+
+/**
+ * Take the oldest received byte and when it arrived (time may be 0)
+ * Returns 0 if nothing was received, does not wait
+ */
+int uart_read(unsigned char *c, unsigned long *time) {
+  unsigned int tail = atomic_load_explicit(&rxTail, memory_order_relaxed);
+
+  if (tail == atomic_load_explicit(&rxHead, memory_order_acquire))
+    return 0;
+
+  *c = rxRing[tail % UART_RX_SIZE].ch;
+  if (time)
+    *time = rxRing[tail % UART_RX_SIZE].time;
+  atomic_store_explicit(&rxTail, tail + 1, memory_order_release);
+  return 1;
+}
+
+/**
+ * Number of received bytes lost because the ring was full
+ */
+unsigned int uart_rxDropped() {
+  return rxDropped;
+}
+
+/**
+ * What uart_sendc() does when the transmit ring is full:
+ * UART_TX_DROP loses the byte (counted), UART_TX_BLOCK waits for room
+ */
+void uart_setTxPolicy(int policy) {
+  txPolicy = policy;
+}
+
+/**
+ * Number of bytes uart_sendc() dropped because the ring was full
+ */
+unsigned int uart_txDropped() {
+  return txDropped;
+}
+
+/**
+ * Send everything still in the ring, waiting on the transmitter
+ * (works with interrupts masked, e.g. before halting)
+ */
+void uart_flush() {
+  unsigned long flags = irq_save();
+
+  while (txTail != txHead) {
+    /* wait until transmitter is empty */
+    do {
+      asm volatile("nop");
+    } while (!(*AUX_MU_LSR & 0x20));
+
+    txFill();
+  }
+
+  irq_restore(flags);
+}
+
+/**
+ *	Send a character (queued, the transmit interrupt sends it)
  */
 void uart_sendc(unsigned char c) {
-  /* wait until transmitter is empty */
-  do {
-    asm volatile("nop");
-  } while (!(*AUX_MU_LSR & 0x20));
+  unsigned long flags = irq_save();
+
+  while (txHead - txTail == UART_TX_SIZE) {
+    if (txPolicy == UART_TX_DROP) {
+      txDropped++;
+      irq_restore(flags);
+      return;
+    }
 
-  /* write the character to the buffer */
-  *AUX_MU_IO = c;
+    if (flags & DAIF_IRQ) {
+      // Interrupts were already off: nothing else will make room
+      while (!(*AUX_MU_LSR & 0x20))
+        asm volatile("nop");
+      txFill();
+    } else {
+      // The pending transmit interrupt wakes wfi up, and runs once
+      // interrupts are back on
+      asm volatile("wfi");
+      irq_restore(flags);
+      flags = irq_save();
+    }
+  }
+
+  txRing[txHead % UART_TX_SIZE] = c;
+  txHead++;
+  *AUX_MU_IER |= AUX_MU_IER_TX;
+
+  irq_restore(flags);
 }
 
 /**
- *	Receive a character
+ *	Receive a character, sleeping until one arrives
  */
 char uart_getc() {
-  char c;
+  unsigned char c;
 
-  /* wait until data is ready (one symbol) */
-  do {
-    asm volatile("nop");
-  } while (!(*AUX_MU_LSR & 0x01));
-
-  /* read it and return */
-  c = (char)(*AUX_MU_IO);
+  /* wait until data is ready (one symbol). Interrupts are masked around
+   * the check, so a byte arriving just before wfi still wakes it up */
+  while (1) {
+    unsigned long flags = irq_save();
+    if (uart_read(&c, 0)) {
+      irq_restore(flags);
+      break;
+    }
+    asm volatile("wfi");
+    irq_restore(flags);
+  }
 
   /* convert carriage return to newline */
   return (c == '\r' ? '\n' : c);
@@ -122,14 +269,15 @@ void uart_dec(int num) {
 
 // Check if the user has just inputted a new key
 unsigned int uart_isReadByteReady() {
-  return (*AUX_MU_LSR & 0x01);
+  return atomic_load_explicit(&rxTail, memory_order_relaxed) !=
+         atomic_load_explicit(&rxHead, memory_order_acquire);
 }
 
 /* New function: Check and return if no new character, don't wait */
 unsigned char getUart() {
   unsigned char ch = 0;
-  if (uart_isReadByteReady())
-    ch = uart_getc();
+  if (uart_read(&ch, 0) && ch == '\r')
+    ch = '\n';
   return ch;
 }
 
@@ -13,6 +13,18 @@
 #define AUX_MU_STAT ((volatile unsigned int *)(MMIO_BASE + 0x00215064))
 #define AUX_MU_BAUD ((volatile unsigned int *)(MMIO_BASE + 0x00215068))
 
+#define AUX_MU_IER_RX 0x0D  // receive interrupt (bits 3:2 are needed as well)
+#define AUX_MU_IER_TX 0x02  // transmitter empty interrupt
+
+/* Received and to be sent bytes buffered around the interrupt handler
+ * (powers of 2) */
+#define UART_RX_SIZE 256
+#define UART_TX_SIZE 2048
+
+/* What uart_sendc() does when the transmit ring is full */
+#define UART_TX_DROP 0   // lose the byte and count it (default)
+#define UART_TX_BLOCK 1  // wait for room
+
 /* Function prototypes */
 void uart_init();
 void uart_sendc(unsigned char c);
@@ -24,5 +36,11 @@ void uart_dec(int num);
 
 unsigned int uart_isReadByteReady();
 unsigned char getUart();
+int uart_read(unsigned char *c, unsigned long *time);
+unsigned int uart_rxDropped();
+void uart_setTxPolicy(int policy);
+unsigned int uart_txDropped();
+void uart_flush();
+void uart_irq();
 void wait_msec(unsigned int n);
 void set_wait_timer(int set, unsigned int msVal);